@@ -14,12 +14,48 @@
  * limitations under the License.
  */
 
-#include <string.h> // strlen strcpy strcat memcpy memmove strstr strchr memcmp
-#include <stdlib.h> // atof
+#include <string.h> // strlen strcpy strcat memcpy memmove memset strstr strchr memcmp
+#include <stdlib.h> // atof malloc calloc free
 #include <ctype.h>  // toupper
 #include "mapcoder.h"
 #include "basics.h"
 
+// boundary tests on several records at once, if the target supports it
+#if defined(__AVX2__)
+#define BOUNDS_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOUNDS_SSE2
+#include <emmintrin.h>
+#endif
+
+// one-time initialisation of the lookup tables
+#ifdef _WIN32
+#include <windows.h>
+typedef INIT_ONCE onceFlag;
+#define ONCE_FLAG_INIT          INIT_ONCE_STATIC_INIT
+#else
+#include <pthread.h>
+typedef pthread_once_t onceFlag;
+#define ONCE_FLAG_INIT          PTHREAD_ONCE_INIT
+#define callOnce(once, build)   pthread_once(once, build)
+#endif
+
+// locks for the shards of the encode cache
+#ifdef SUPPORT_ENCODE_CACHE
+#ifdef _WIN32
+typedef CRITICAL_SECTION cacheLock;
+#define initCacheLock(lock)     InitializeCriticalSection(lock)
+#define lockCache(lock)         EnterCriticalSection(lock)
+#define unlockCache(lock)       LeaveCriticalSection(lock)
+#else
+typedef pthread_mutex_t cacheLock;
+#define initCacheLock(lock)     pthread_mutex_init(lock, NULL)
+#define lockCache(lock)         pthread_mutex_lock(lock)
+#define unlockCache(lock)       pthread_mutex_unlock(lock)
+#endif
+#endif
+
 #define FAST_ENCODE
 #ifdef FAST_ENCODE
 
@@ -33,18 +69,40 @@
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// nanodegrees per degree, for decoding to integers
+#define NANODEGREES 1000000000LL
+
+// fractions of a microdegree are also kept in 64-bit fixed point, with FRACTION_BITS bits after the binary point
+#define FRACTION_BITS 40
+#define FRACTION_ONE  ((long long) 1 << FRACTION_BITS)
+
+// both precise and microdegree encoding are always available; this is the one used unless asked otherwise
+#ifdef SUPPORT_HIGH_PRECISION
+#define PRECISE_BY_DEFAULT 1
+#else
+#define PRECISE_BY_DEFAULT 0
+#endif
+
 typedef struct {
     // input
     int lat32, lon32;
     double fraclat, fraclon;
+    long long fixedlat, fixedlon;    // fraclat and fraclon in fixed point (exact, since scaled by a power of two)
+    int precise;                     // if 0, lat32,lon32 is rounded and fractions are 0 (microdegree encoding)
+    const TerritorySet *territories; // if not NULL, only encode in these territories (when encoding for all territories)
     // output
     Mapcodes *mapcodes;
+    TrajectoryEncoder *trajectory;   // if not NULL, the records that contain the point are added to it
 } encodeRec;
 
+typedef char territorySetHoldsAllTerritories[(TERRITORY_SET_WORDS * 32 >= MAX_CCODE) ? 1 : -1]; // see TerritorySet
+typedef char territoryResultsHoldAllTerritories[(MAX_NR_OF_TERRITORY_RESULTS >= MAX_CCODE) ? 1 : -1]; // see TerritoryResults
+
 typedef struct {
     // input
-    const char *orginput;   // original full input string
-    char minput[MAX_MAPCODE_RESULT_LEN]; // room to manipulate clean copy of input
+    const char *orginput;   // original full input (ends at orglen characters, or at a zero-terminator)
+    size_t orglen;
+    char minput[MAX_MAPCODE_RESULT_LEN]; // room to manipulate clean copy of input (proper mapcode and extension)
     const char *mapcode;    // input mapcode (first character of proper mapcode excluding territory code)
     const char *extension;  // input extension (or empty)
     int context;            // input territory context (or negative)
@@ -52,6 +110,7 @@ typedef struct {
     // output
     double lat, lon;        // result
     int lat32, lon32;       // result in integer arithmetic (millionts of degrees)
+    long long latNano, lonNano; // result in integer arithmetic (nanodegrees, truncated)
 } decodeRec;
 
 
@@ -110,47 +169,538 @@ static int coDex(int m)
 #define smartDiv(m)          (mminfo[m].flags>>16)
 #define boundaries(m)        (&mminfo[m])
 
-static int isInRange(int x, int minx, int maxx) // returns nonzero if x in the range minx...maxx
+static int xDivider4(int miny, int maxy)
+{
+    if (miny >= 0) { // both above equator? then miny is closest
+        return xdivider19[(miny) >> 19];
+    }
+    if (maxy >= 0) { // opposite sides? then equator is worst
+        return xdivider19[0];
+    }
+    return xdivider19[(-maxy) >> 19]; // both negative, so maxy is closest to equator
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Territory record index
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The boundary rectangle of every territory (for Earth: the whole world) is divided into a grid of
+// TERRITORY_GRID x TERRITORY_GRID cells. Each cell holds a bitmask of the records of the territory that
+// overlap the cell, so the encoder only needs to test those records (in their original order).
+// Every territory also has a bitmask of its records that are not restricted, for checking decode results.
+
+#define TERRITORY_GRID      8
+#define RECMASK_BITS        64
+#define MAX_RECMASK_WORDS   ((WORST_RECS_PER_CCODE + RECMASK_BITS - 1) / RECMASK_BITS)
+
+typedef unsigned long long recmask; // bit b represents record firstrec(ccode) + b
+
+typedef struct {
+    int minx, miny;         // corner of the territory boundary
+    int maxx;               // right side of the territory boundary
+    int cellw, cellh;       // size of a cell
+    int words;              // number of recmask words per cell
+    int start;              // index of the first word of the first cell in territoryCells
+    int parent;             // country to continue encoding in, for a subdivision whose last record refers to it (or -1)
+    int unrestricted;       // index of the first word of the records that are not restricted in unrestrictedRecords
+} territoryIndexRec;
+
+static territoryIndexRec territoryIndex[MAX_CCODE];
+static recmask territoryCells[TERRITORY_GRID * TERRITORY_GRID * (MAX_CCODE + NR_RECS / RECMASK_BITS)];
+static recmask unrestrictedRecords[MAX_CCODE + NR_RECS / RECMASK_BITS];
+
+static int lowestBit(recmask bits) // returns index of lowest bit set (bits must be nonzero)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    static const signed char debruijn64[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6};
+    return debruijn64[((bits & (0 - bits)) * 0x03F79D71B4CB0A89ULL) >> 58];
+#endif
+}
+
+// returns nonzero if the range lo...hi overlaps cell c of a grid starting at 'start' with cells of size 'size'
+static int overlapsCell(int lo, int hi, int start, int size, int c)
+{
+    // the outer cells extend to infinity, as points are clamped into the grid
+    if (c > 0 && hi <= start + c * size)
+        return 0;
+    if (c < TERRITORY_GRID - 1 && lo >= start + (c + 1) * size)
+        return 0;
+    return 1;
+}
+
+static void buildTerritoryIndex(void)
 {
-    if (minx <= x && x < maxx)
-        return 1;
+    int start = 0;
+    int unrestricted = 0;
+    for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+        territoryIndexRec *t = &territoryIndex[ccode];
+        int from = firstrec(ccode);
+        int upto = lastrec(ccode);
+        int maxy;
+
+        if (ccode == ccode_earth) {
+            t->minx = -180000000;
+            t->miny = -90000000;
+            t->maxx = 180000000;
+            maxy = 90000000;
+        } else {
+            const mminforec *b = boundaries(upto);
+            t->minx = b->minx;
+            t->miny = b->miny;
+            t->maxx = b->maxx;
+            maxy = b->maxy;
+        }
+        t->cellw = (t->maxx - t->minx + TERRITORY_GRID - 1) / TERRITORY_GRID;
+        t->cellh = (maxy - t->miny + TERRITORY_GRID - 1) / TERRITORY_GRID;
+        if (t->cellw < 1)
+            t->cellw = 1;
+        if (t->cellh < 1)
+            t->cellh = 1;
+        t->words = (upto - from + RECMASK_BITS) / RECMASK_BITS;
+        t->start = start;
+        t->parent = (isRestricted(upto) && isSubdivision(ccode) && !isNameless(upto) && recType(upto) <= 1 ?
+                     ParentTerritoryOf(ccode) : -1);
+        start += TERRITORY_GRID * TERRITORY_GRID * t->words;
+        t->unrestricted = unrestricted;
+        unrestricted += t->words;
+
+        for (int i = from; i <= upto; i++) {
+            const mminforec *b = boundaries(i);
+            int bit = i - from;
+            if (!isRestricted(i))
+                unrestrictedRecords[t->unrestricted + bit / RECMASK_BITS] |= ((recmask) 1) << (bit % RECMASK_BITS);
+            if (coDex(i) >= 54)
+                continue; // never used by the encoder
+            for (int cy = 0; cy < TERRITORY_GRID; cy++) {
+                if (!overlapsCell(b->miny, b->maxy, t->miny, t->cellh, cy))
+                    continue;
+                for (int cx = 0; cx < TERRITORY_GRID; cx++) {
+                    // a record may be matched up to 360 degrees away (see setBounds), so try shifted copies as well
+                    int shift;
+                    for (shift = -2; shift <= 2; shift++) {
+                        if (overlapsCell(b->minx + shift * 360000000, b->maxx + shift * 360000000, t->minx, t->cellw, cx))
+                            break;
+                    }
+                    if (shift <= 2) {
+                        recmask *cell = &territoryCells[t->start + (cy * TERRITORY_GRID + cx) * t->words];
+                        cell[bit / RECMASK_BITS] |= ((recmask) 1) << (bit % RECMASK_BITS);
+                    }
+                }
+            }
+        }
+    }
+}
 
-    // 1.32 fix FIJI edge case
-    if (x < minx)
+// returns the candidate records (t->words bitmasks) for x,y, which is known to be inside the territory boundary
+static const recmask *territoryCandidates(int ccode, int x, int y)
+{
+    const territoryIndexRec *t = &territoryIndex[ccode];
+    if (x < t->minx) // see setBounds
         x += 360000000;
-    else
+    else if (x >= t->maxx)
         x -= 360000000;
+    int cx = (x - t->minx) / t->cellw;
+    int cy = (y - t->miny) / t->cellh;
+    if (cx < 0)
+        cx = 0;
+    else if (cx >= TERRITORY_GRID)
+        cx = TERRITORY_GRID - 1;
+    if (cy < 0)
+        cy = 0;
+    else if (cy >= TERRITORY_GRID)
+        cy = TERRITORY_GRID - 1;
+    return &territoryCells[t->start + (cy * TERRITORY_GRID + cx) * t->words];
+}
 
-    if (minx <= x && x < maxx)
-        return 1;
+// returns the records of territory ccode that are not restricted (territoryIndex[ccode].words bitmasks)
+static const recmask *unrestrictedRecordsOf(int ccode)
+{
+    return &unrestrictedRecords[territoryIndex[ccode].unrestricted];
+}
 
-    return 0;
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Boundary tests
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Copies of the record boundaries as separate arrays, so they can be tested 4 (SSE2) or 8 (AVX2) at a time.
+// Arrays are padded, so a test of 8 records starting at any record stays in range.
+//
+// A record that crosses the 180 degree meridian (such as in FIJI) also gets a second x-range, 360 degrees off, so
+// that a normalised x (-180...180 degrees, see normalisedX) is inside the record if it is inside either x-range;
+// xwrap is what must be added to an x in the second range to bring it back into the record.
+
+#define BOUNDS_PADDING      8
+
+typedef struct {
+    int minx[NR_RECS + BOUNDS_PADDING];
+    int miny[NR_RECS + BOUNDS_PADDING];
+    int maxx[NR_RECS + BOUNDS_PADDING];
+    int maxy[NR_RECS + BOUNDS_PADDING];
+    int minx2[NR_RECS + BOUNDS_PADDING]; // second x-range (empty if not crossing 180 degrees)
+    int maxx2[NR_RECS + BOUNDS_PADDING];
+    int xwrap[NR_RECS + BOUNDS_PADDING];
+} boundsArrays;
+
+static boundsArrays recordBounds;           // as fitsInside
+static boundsArrays recordBoundsWithRoom;   // with some room around them, for checking decode results
+
+static void setBounds(boundsArrays *a, int m, int minx, int miny, int maxx, int maxy)
+{
+    a->minx[m] = minx;
+    a->miny[m] = miny;
+    a->maxx[m] = maxx;
+    a->maxy[m] = maxy;
+    if (maxx > 180000000) { // crosses 180 degrees eastwards
+        a->xwrap[m] = 360000000;
+    } else if (minx <= -180000000) { // crosses (or touches) -180 degrees westwards
+        a->xwrap[m] = -360000000;
+    } else {
+        a->xwrap[m] = 0;
+    }
+    a->minx2[m] = minx - a->xwrap[m];
+    a->maxx2[m] = (a->xwrap[m] ? maxx - a->xwrap[m] : minx); // empty if not crossing
+}
+
+static void buildBounds(void)
+{
+    for (int m = 0; m < NR_RECS; m++) {
+        const mminforec *b = boundaries(m);
+        int xdiv8 = xDivider4(b->miny, b->maxy) / 4; // should be /8 but there's some extra margin
+        setBounds(&recordBounds, m, b->minx, b->miny, b->maxx, b->maxy);
+        setBounds(&recordBoundsWithRoom, m, b->minx - xdiv8, b->miny - 60, b->maxx + xdiv8, b->maxy + 60);
+    }
+    // padding is left empty (0...0), which never contains a point
+}
+
+// returns x (in microdegrees, at most 360 degrees off) normalised to -180...180 degrees
+static int normalisedX(int x)
+{
+    if (x >= 180000000)
+        return x - 360000000;
+    if (x < -180000000)
+        return x + 360000000;
+    return x;
 }
 
+// returns nonzero if normalised x,y is inside record m
 static int fitsInside(int x, int y, int m)
 {
-    const mminforec *b = boundaries(m);
-    return (b->miny <= y && y < b->maxy && isInRange(x, b->minx, b->maxx));
+    const boundsArrays *a = &recordBounds;
+    return (a->miny[m] <= y) & (y < a->maxy[m]) &
+           (((a->minx[m] <= x) & (x < a->maxx[m])) | ((a->minx2[m] <= x) & (x < a->maxx2[m])));
 }
 
-static int xDivider4(int miny, int maxy)
+// returns nonzero if normalised x,y is inside record m, with some room around it
+static int fitsInsideWithRoom(int x, int y, int m)
 {
-    if (miny >= 0) { // both above equator? then miny is closest
-        return xdivider19[(miny) >> 19];
+    const boundsArrays *a = &recordBoundsWithRoom;
+    return (a->miny[m] <= y) & (y < a->maxy[m]) &
+           (((a->minx[m] <= x) & (x < a->maxx[m])) | ((a->minx2[m] <= x) & (x < a->maxx2[m])));
+}
+
+// returns a bitmask of which of the 8 records from 'first' contain normalised x,y
+static int containedIn8(const boundsArrays *a, int x, int y, int first)
+{
+#if defined(BOUNDS_AVX2)
+    const __m256i vx = _mm256_set1_epi32(x);
+    const __m256i vy = _mm256_set1_epi32(y);
+    const __m256i minx = _mm256_loadu_si256((const __m256i *) &a->minx[first]);
+    const __m256i maxx = _mm256_loadu_si256((const __m256i *) &a->maxx[first]);
+    const __m256i minx2 = _mm256_loadu_si256((const __m256i *) &a->minx2[first]);
+    const __m256i maxx2 = _mm256_loadu_si256((const __m256i *) &a->maxx2[first]);
+    const __m256i miny = _mm256_loadu_si256((const __m256i *) &a->miny[first]);
+    const __m256i maxy = _mm256_loadu_si256((const __m256i *) &a->maxy[first]);
+    // minx <= x < maxx  ==  !(minx > x) && (maxx > x)
+    __m256i inx = _mm256_andnot_si256(_mm256_cmpgt_epi32(minx, vx), _mm256_cmpgt_epi32(maxx, vx));
+    inx = _mm256_or_si256(inx, _mm256_andnot_si256(_mm256_cmpgt_epi32(minx2, vx), _mm256_cmpgt_epi32(maxx2, vx)));
+    __m256i iny = _mm256_andnot_si256(_mm256_cmpgt_epi32(miny, vy), _mm256_cmpgt_epi32(maxy, vy));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(inx, iny)));
+#elif defined(BOUNDS_SSE2)
+    const __m128i vx = _mm_set1_epi32(x);
+    const __m128i vy = _mm_set1_epi32(y);
+    int hits = 0;
+    for (int half = 0; half < 8; half += 4) {
+        const __m128i minx = _mm_loadu_si128((const __m128i *) &a->minx[first + half]);
+        const __m128i maxx = _mm_loadu_si128((const __m128i *) &a->maxx[first + half]);
+        const __m128i minx2 = _mm_loadu_si128((const __m128i *) &a->minx2[first + half]);
+        const __m128i maxx2 = _mm_loadu_si128((const __m128i *) &a->maxx2[first + half]);
+        const __m128i miny = _mm_loadu_si128((const __m128i *) &a->miny[first + half]);
+        const __m128i maxy = _mm_loadu_si128((const __m128i *) &a->maxy[first + half]);
+        // minx <= x < maxx  ==  !(minx > x) && (maxx > x)
+        __m128i inx = _mm_andnot_si128(_mm_cmpgt_epi32(minx, vx), _mm_cmpgt_epi32(maxx, vx));
+        inx = _mm_or_si128(inx, _mm_andnot_si128(_mm_cmpgt_epi32(minx2, vx), _mm_cmpgt_epi32(maxx2, vx)));
+        __m128i iny = _mm_andnot_si128(_mm_cmpgt_epi32(miny, vy), _mm_cmpgt_epi32(maxy, vy));
+        hits |= _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(inx, iny))) << half;
     }
-    if (maxy >= 0) { // opposite sides? then equator is worst
-        return xdivider19[0];
+    return hits;
+#else
+    int hits = 0;
+    for (int i = 0; i < 8; i++) {
+        int m = first + i;
+        hits |= ((a->miny[m] <= y) & (y < a->maxy[m]) &
+                 (((a->minx[m] <= x) & (x < a->maxx[m])) | ((a->minx2[m] <= x) & (x < a->maxx2[m])))) << i;
     }
-    return xdivider19[(-maxy) >> 19]; // both negative, so maxy is closest to equator
+    return hits;
+#endif
 }
 
-static int fitsInsideWithRoom(int x, int y, int m)
+// returns the subset of candidates (records from 'first') that contain normalised x,y
+static recmask containedIn(const boundsArrays *a, int x, int y, int first, recmask candidates)
+{
+    recmask hits = 0;
+    for (int i = 0; i < RECMASK_BITS; i += 8) {
+        if ((candidates >> i) & 255)
+            hits |= ((recmask) containedIn8(a, x, y, first + i)) << i;
+    }
+    return hits & candidates;
+}
+
+#ifdef FAST_ENCODE
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Territory candidates
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// redivar is a kd-tree: a node is a split value followed by the offset of its "greater than" subtree (its "less
+// or equal" subtree follows directly); a leaf is a count followed by that many territories. Levels alternate
+// between splitting on latitude (even levels) and longitude (odd levels).
+//
+// For a faster lookup, the tree is rebuilt on first use in breadth-first (Eytzinger) order: the children of node n
+// are 2n+1 and 2n+2. Leaves above the bottom level are extended downwards, so every lookup takes exactly
+// REDIVAR_DEPTH steps without data-dependent branches.
+
+#define REDIVAR_DEPTH       11                              // must be at least the depth of the deepest leaf of redivar
+#define REDIVAR_NODES       ((1 << REDIVAR_DEPTH) - 1)
+
+static int redivarReady;                                    // 1 if built, -1 if redivar does not fit
+static int redivarSplit[REDIVAR_NODES];                     // split value of each node
+static short redivarLeaf[REDIVAR_NODES + 1];                // offset in redivar of the leaf of each bottom node
+
+// original walk over redivar, returns the leaf (count followed by territories) for x,y
+static const int *redivarWalk(int x, int y)
+{
+    int HOR = 1;
+    int i = 0; // pointer into redivar
+    for (; ;) {
+        int v2 = redivar[i++];
+        HOR = 1 - HOR;
+        if (v2 >= 0 && v2 < 1024) { // leaf?
+            return &redivar[i - 1];
+        }
+        else {
+            int coord = (HOR ? x : y);
+            if (coord > v2) {
+                i = redivar[i];
+            }
+            else {
+                i++;
+            }
+        }
+    }
+}
+
+// narrows area (minx, miny, maxx, maxy) to the part that has the same leaf of redivar as x,y
+static void redivarArea(int x, int y, int *area)
+{
+    int HOR = 1;
+    int i = 0; // pointer into redivar
+    for (; ;) {
+        int v2 = redivar[i++];
+        HOR = 1 - HOR;
+        if (v2 >= 0 && v2 < 1024) { // leaf?
+            return;
+        }
+        else {
+            int coord = (HOR ? x : y);
+            if (coord > v2) {
+                if (area[HOR ? 0 : 1] < v2 + 1)
+                    area[HOR ? 0 : 1] = v2 + 1;
+                i = redivar[i];
+            }
+            else {
+                if (area[HOR ? 2 : 3] > v2 + 1)
+                    area[HOR ? 2 : 3] = v2 + 1;
+                i++;
+            }
+        }
+    }
+}
+
+// stores redivar subtree at offset i as node n (at given depth); returns 0 if the subtree is too deep
+static int buildRedivarNode(int i, int n, int depth)
+{
+    int v2 = redivar[i];
+    if (depth == REDIVAR_DEPTH) {
+        if (v2 >= 0 && v2 < 1024) { // leaf?
+            redivarLeaf[n - REDIVAR_NODES] = (short) i;
+            return 1;
+        }
+        return 0;
+    }
+    if (v2 >= 0 && v2 < 1024) { // leaf? then extend it downwards
+        redivarSplit[n] = 0x7fffffff; // never greater
+        return buildRedivarNode(i, 2 * n + 1, depth + 1) && buildRedivarNode(i, 2 * n + 2, depth + 1);
+    }
+    redivarSplit[n] = v2;
+    return buildRedivarNode(i + 2, 2 * n + 1, depth + 1) && buildRedivarNode(redivar[i + 1], 2 * n + 2, depth + 1);
+}
+
+static void buildRedivar(void)
+{
+    redivarReady = (buildRedivarNode(0, 0, 0) ? 1 : -1);
+}
+
+// returns the leaf of redivar (count followed by territories) for x,y
+static const int *redivarLeafOf(int x, int y)
+{
+    if (redivarReady < 0)
+        return redivarWalk(x, y);
+
+    int n = 0;
+    for (int depth = 0; depth < REDIVAR_DEPTH; depth++) {
+        int coord = ((depth & 1) ? x : y);
+        n = 2 * n + 1 + (coord > redivarSplit[n]);
+    }
+    return &redivar[redivarLeaf[n - REDIVAR_NODES]];
+}
+
+#endif // FAST_ENCODE
+
+#ifdef WORLD_INDEX_CELL_SIZE
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  World index
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The world is divided into cells of WORLD_INDEX_CELL_SIZE microdegrees. Each cell lists all records (of all
+// territories, in their original order) that overlap the cell and belong to a territory whose boundary overlaps
+// the cell, so encoding for all territories only needs to look at those records.
+
+#define WORLD_INDEX_COLUMNS ((360000000 + WORLD_INDEX_CELL_SIZE - 1) / WORLD_INDEX_CELL_SIZE)
+#define WORLD_INDEX_ROWS    (180000000 / WORLD_INDEX_CELL_SIZE + 1) // includes latitude 90
+
+static onceFlag worldIndexOnce = ONCE_FLAG_INIT; // the world index is only built by the first encode that uses it
+static int worldIndexReady;                     // 1 if built, -1 if there was not enough memory
+static int *worldCellStart;                     // per cell, the first entry in worldCellRecords (plus an end marker)
+static unsigned short *worldCellRecords;        // per cell, the records overlapping it
+static short recordTerritory[NR_RECS];          // territory of each record
+
+// determines the cells c0...c1 (of n cells of given size from start) overlapped by range lo...hi; returns 0 if none
+static int cellRange(int lo, int hi, int start, int size, int n, int *c0, int *c1)
+{
+    if (hi <= start || lo >= start + n * size || lo >= hi)
+        return 0;
+    *c0 = (lo <= start ? 0 : (lo - start) / size);
+    *c1 = (hi - 1 - start) / size;
+    if (*c1 >= n)
+        *c1 = n - 1;
+    return 1;
+}
+
+// adds record m to all cells it overlaps (or just counts it, if worldCellRecords is NULL); returns nr of cells
+static int addToWorldIndex(int m, const mminforec *territory)
 {
+    int added = 0;
     const mminforec *b = boundaries(m);
-    int xdiv8 = xDivider4(b->miny, b->maxy) / 4; // should be /8 but there's some extra margin
-    return (b->miny - 60 <= y && y < b->maxy + 60 && isInRange(x, b->minx - xdiv8, b->maxx + xdiv8));
+    int cy0, cy1;
+    if (!cellRange(b->miny, b->maxy, -90000000, WORLD_INDEX_CELL_SIZE, WORLD_INDEX_ROWS, &cy0, &cy1))
+        return 0;
+
+    for (int cy = cy0; cy <= cy1; cy++) {
+        int lastcx = -1;
+        for (int shift = -1; shift <= 1; shift++) { // see setBounds
+            int cx0, cx1;
+            if (!cellRange(b->minx + shift * 360000000, b->maxx + shift * 360000000,
+                           -180000000, WORLD_INDEX_CELL_SIZE, WORLD_INDEX_COLUMNS, &cx0, &cx1))
+                continue;
+            if (cx0 <= lastcx)
+                cx0 = lastcx + 1; // do not add a record to a cell twice
+            for (int cx = cx0; cx <= cx1; cx++) {
+                if (territory) { // skip cells outside the territory boundary
+                    int celly = -90000000 + cy * WORLD_INDEX_CELL_SIZE;
+                    int cellx = -180000000 + cx * WORLD_INDEX_CELL_SIZE;
+                    int t, inside = 0;
+                    if (territory->miny < celly + WORLD_INDEX_CELL_SIZE && celly < territory->maxy)
+                        for (t = -1; t <= 1 && !inside; t++)
+                            inside = (territory->minx + t * 360000000 < cellx + WORLD_INDEX_CELL_SIZE &&
+                                      cellx < territory->maxx + t * 360000000);
+                    if (!inside)
+                        continue;
+                }
+                int cell = cy * WORLD_INDEX_COLUMNS + cx;
+                if (worldCellRecords)
+                    worldCellRecords[worldCellStart[cell]++] = (unsigned short) m;
+                else
+                    worldCellStart[cell]++;
+                added++;
+            }
+            if (cx1 > lastcx)
+                lastcx = cx1;
+        }
+    }
+    return added;
+}
+
+static void buildWorldIndex(void)
+{
+    const int cells = WORLD_INDEX_ROWS * WORLD_INDEX_COLUMNS;
+    int total = 0;
+
+    worldCellStart = (int *) calloc(cells + 1, sizeof(int));
+    if (worldCellStart == NULL) {
+        worldIndexReady = -1;
+        return;
+    }
+
+    // count the records of each cell, then fill them in
+    for (int pass = 0; pass < 2; pass++) {
+        for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+            int upto = lastrec(ccode);
+            for (int i = firstrec(ccode); i <= upto; i++) {
+                recordTerritory[i] = (short) ccode;
+                if (coDex(i) < 54)
+                    addToWorldIndex(i, (ccode == ccode_earth ? NULL : boundaries(upto)));
+            }
+        }
+        if (pass == 0) {
+            for (int cell = 0; cell <= cells; cell++) { // turn counts into start positions
+                int count = worldCellStart[cell];
+                worldCellStart[cell] = total;
+                total += count;
+            }
+            worldCellRecords = (unsigned short *) malloc((total > 0 ? total : 1) * sizeof(unsigned short));
+            if (worldCellRecords == NULL) {
+                free(worldCellStart);
+                worldCellStart = NULL;
+                worldIndexReady = -1;
+                return;
+            }
+        }
+    }
+
+    // filling has moved every start position to the start of the next cell
+    for (int cell = cells; cell > 0; cell--)
+        worldCellStart[cell] = worldCellStart[cell - 1];
+    worldCellStart[0] = 0;
+    worldIndexReady = 1;
 }
 
+#endif // WORLD_INDEX_CELL_SIZE
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 //  Lowlevel ccode, iso, and disambiguation
@@ -192,6 +742,8 @@ static int disambiguate_str(const char *s, int len) // returns disambiguation >=
 }
 
 
+static char disambiguate_iso3[4] = {'1', '?', '?', 0}; // cache for disambiguation
+
 // returns coode, or negative if invalid
 static int ccode_of_iso3(const char *in_iso, int parentcode)
 {
@@ -225,7 +777,6 @@ static int ccode_of_iso3(const char *in_iso, int parentcode)
     iso[3] = 0;
 
     if (iso[2] == 0 || iso[2] == ' ') { // 2-letter iso code?
-        static char disambiguate_iso3[4] = {'1', '?', '?', 0}; // cache for disambiguation
         if (parentcode > 0)
             disambiguate_iso3[0] = (char) ('0' + parentcode);
         disambiguate_iso3[1] = iso[0];
@@ -299,6 +850,30 @@ static int ccode_of_iso3(const char *in_iso, int parentcode)
     return (int) ((s - entity_iso) / 4);
 }
 
+// returns the ccode of territory code tc (international if tc is not valid), as ccode_of_iso3 does for its full name
+static int ccode_of_context(int tc)
+{
+    if (tc < 1 || tc > MAX_MAPCODE_TERRITORY_CODE)
+        return ccode_earth;
+
+    int ccode = tc - 1;
+    int p = ParentLetter(ccode);
+    if (p && entity_iso[ccode * 4] >= '0' && entity_iso[ccode * 4] <= '9') // 2-letter code of a subdivision?
+        disambiguate_iso3[0] = (char) ('0' + p);
+    return ccode;
+}
+
+// returns the disambiguation of territory code tc if it is a parent country, as disambiguate_str does for its name,
+// or negative
+static int parent_of_context(int tc)
+{
+    for (int p = 1; p <= 8; p++) {
+        if (parentnr[p] == tc - 1)
+            return p;
+    }
+    return -1;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -306,11 +881,10 @@ static int ccode_of_iso3(const char *in_iso, int parentcode)
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void encodeExtension(char *result, int extrax4, int extray, int dividerx4, int dividery, int extraDigits,
-                            int ydirection,
-                            const encodeRec *enc) // append extra characters to result for more precision
+// integer computation of extension digits (for coordinates rounded to microdegrees)
+static void encodeExtensionMicrodegrees(char *result, int extrax4, int extray, int dividerx4, int dividery,
+                                        int extraDigits)
 {
-#ifndef SUPPORT_HIGH_PRECISION // old integer-arithmetic version
     if (extraDigits < 0)
         extraDigits = 0;
     else if (extraDigits > 2)
@@ -331,53 +905,128 @@ static void encodeExtension(char *result, int extrax4, int extray, int dividerx4
             *s++ = encode_chars[row2 * 6 + column2];
         *s++ = 0;
     }
-#else // new floating-point version
+}
+
+// reference floating-point computation of n extension digits (one per pair) of position enc (in cells)
+static void extensionDigitsFloat(int *g, int n, double enc)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        enc *= 30;
+        g[i] = (int) enc;
+        if (g[i] < 0)
+            g[i] = 0;
+        else if (g[i] > 29)
+            g[i] = 29;
+        enc -= g[i];
+    }
+}
+
+// computes the next digit of position p/divide (times 30) in fixed point; returns -1 if the digit is within margin of a
+// digit boundary (never if margin is negative, for an exact position)
+static int nextExtensionDigit(long long *p, long long divide, long long margin)
+{
+    long long r;
+    int g;
+
+    // positions of 2 or more (or -1 or less) behave as 2 (or -1): they produce digits 29 (or 0) forever
+    if (*p > 2 * divide)
+        *p = 2 * divide;
+    else if (*p < -divide)
+        *p = -divide;
+    *p *= 30;
+
+    r = *p % divide;
+    if (r < 0)
+        r += divide;
+    if ((r <= margin || divide - r <= margin) && *p >= -margin && *p <= 30 * divide + margin)
+        return -1; // too close to a digit boundary: rounding of the floating-point version decides
+
+    g = (*p < 0) ? 0 : (int) (*p / divide);
+    if (g > 29)
+        g = 29;
+    *p -= g * divide;
+    return g;
+}
+
+// fixed-point computation of n extension digits of position p/divide; returns 0 if a digit is within margin of a
+// digit boundary
+static int extensionDigitsFixed(int *g, int n, long long p, long long divide, long long margin)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        g[i] = nextExtensionDigit(&p, divide, margin);
+        if (g[i] < 0)
+            return 0;
+    }
+    return 1;
+}
+
+// appends extra characters to result for more precision; the x and y digits are computed separately:
+// - with a fraction of a microdegree, in fixed point; a digit within 2^-16 of a boundary (where the fixed-point
+//   position, within 2^-40 times 30 per digit of the floating-point one, might give another digit) is left to the
+//   floating-point loop, so the digits are bit-identical to extensionDigitsFloat
+// - for a whole number of microdegrees, exactly in integers, without any floating point; these digits are NOT always
+//   those of extensionDigitsFloat: if the position is exactly on a digit boundary, the floating-point loop may round
+//   down to the cell that ends there (ending in digits 29, like "-XJ8F9K9K"), where the integer one always picks the
+//   cell that starts there ("-XJ8G5D5D"); elsewhere both agree
+static void encodeExtension(char *result, int extrax4, int extray, int dividerx4, int dividery, int extraDigits,
+                            int ydirection, const encodeRec *enc)
+{
+    if (!enc->precise) { // old integer-arithmetic version (microdegree encoding, at most 2 digits)
+        encodeExtensionMicrodegrees(result, extrax4, extray, dividerx4, dividery, extraDigits);
+        return;
+    }
+
     char *s = result + strlen(result);
-    double encx = (extrax4 + 4 * enc->fraclon) / (dividerx4);
-    double ency = (extray + enc->fraclat * ydirection) / (dividery);
+    int gx[MAX_PRECISION_DIGITS / 2 + 1], gy[MAX_PRECISION_DIGITS / 2 + 1];
+    int i, n;
 
     if (extraDigits < 0)
         extraDigits = 0;
     else if (extraDigits > MAX_PRECISION_DIGITS)
         extraDigits = MAX_PRECISION_DIGITS;
+    n = (extraDigits + 1) / 2;
+
+    const long long dividex = (long long) dividerx4 << FRACTION_BITS;
+    const long long dividey = (long long) dividery << FRACTION_BITS;
+    if (!extensionDigitsFixed(gx, n, (long long) extrax4 * FRACTION_ONE + 4 * enc->fixedlon, dividex,
+                              (enc->fixedlon == 0) ? -1 : (dividex >> 16)))
+        extensionDigitsFloat(gx, n, (extrax4 + 4 * enc->fraclon) / (dividerx4));
+    if (!extensionDigitsFixed(gy, n, (long long) extray * FRACTION_ONE + enc->fixedlat * ydirection, dividey,
+                              (enc->fixedlat == 0) ? -1 : (dividey >> 16)))
+        extensionDigitsFloat(gy, n, (extray + enc->fraclat * ydirection) / (dividery));
 
     if (extraDigits > 0)
         *s++ = '-';
 
-    while (extraDigits-- > 0) {
-        encx *= 30;
-        int gx = (int) encx;
-        if (gx < 0)
-            gx = 0;
-        else if (gx > 29)
-            gx = 29;
-
-        ency *= 30;
-        int gy = (int) ency;
-        if (gy < 0)
-            gy = 0;
-        else if (gy > 29)
-            gy = 29;
-
-        int column1 = gx / 6;
-        int column2 = gx % 6;
-        int row1 = gy / 5;
-        int row2 = gy % 5;
+    for (i = 0; i < n; i++) {
+        int column1 = gx[i] / 6;
+        int column2 = gx[i] % 6;
+        int row1 = gy[i] / 5;
+        int row2 = gy[i] % 5;
 
         // add postfix:
         *s++ = encode_chars[row1 * 5 + column1];
-        if (extraDigits-- > 0)
+        if (--extraDigits > 0)
             *s++ = encode_chars[row2 * 6 + column2];
-        *s = 0;
-
-        encx -= gx;
-        ency -= gy;
+        extraDigits--;
     }
-#endif
+    *s = 0;
 }
 
 #define decodeChar(c) decode_chars[(unsigned char)c] // force c to be in range of the index, between 0 and 255
 
+#ifdef SUPPORT_HIGH_PRECISION
+// returns 1000 * num / den (for num >= 0, den > 0), truncated, without overflow
+static long long nanoOf(long long num, long long den)
+{
+    return 1000 * (num / den) + (1000 * (num % den)) / den;
+}
+#endif
+
 // this routine takes the integer-arithmeteic decoding results (in millionths of degrees), adds any floating-point precision digits, and returns the result (still in millionths)
 static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
     int ydirection)
@@ -387,7 +1036,7 @@ static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
   int extrax, extray;
 
   if (*extrapostfix) {
-    c1 = decodeChar(extrapostfix[0]);
+    int c1 = decodeChar(extrapostfix[0]);
     if (c1 < 0)
         c1 = 0;
     else if (c1 > 29)
@@ -395,7 +1044,7 @@ static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
     int row1 =(c1 / 5);
     int column1 = (c1 % 5);
 
-    c2 = decodeChar(extrapostfix[1]) ? extrapostfix[1] : 72); // 72='H'=code 15=(3+2*6)
+    int c2 = decodeChar(extrapostfix[1] ? extrapostfix[1] : 72); // 72='H'=code 15=(3+2*6)
     if (c2 < 0)
         c2 = 0;
     else if (c2 > 29)
@@ -417,6 +1066,10 @@ static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
     double processor = 1.0;
     dec->lon = 0;
     dec->lat = 0;
+
+    // the first MAX_PRECISION_DIGITS characters also exactly, as numerators over 2 * unit
+    long long unit = 1;
+    long long numx = 1, numy = 1;
     while (*extrapostfix) {
         int c1 = decodeChar(*extrapostfix++);
         if (c1 < 0 || c1 == 30)
@@ -442,6 +1095,12 @@ static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
         processor *= 30;
         dec->lon += (column1 * 6 + column2) / processor;
         dec->lat += (row1 * 5 + row2 - halfcolumn) / processor;
+
+        if (unit < 810000) { // 30 ^ (MAX_PRECISION_DIGITS / 2)
+            unit *= 30;
+            numx = 30 * numx - 29 + 2 * (column1 * 6 + column2);
+            numy = 30 * numy - 29 + 2 * (row1 * 5 + row2) - (halfcolumn != 0);
+        }
     }
 
     dec->lon += 0.5 / processor;
@@ -453,6 +1112,9 @@ static int decodeExtension(decodeRec *dec, int dividerx4, int dividery,
     dec->lon += dec->lon32;
     dec->lat += dec->lat32;
 
+    dec->lonNano = 1000LL * dec->lon32 + nanoOf(dividerx4 * numx, 8 * unit);
+    dec->latNano = 1000LL * dec->lat32 + ydirection * nanoOf((long long) dividery * numy, 2 * unit);
+
     // also convert back to int
     dec->lon32 = (int) dec->lon;
     dec->lat32 = (int) dec->lat;
@@ -560,6 +1222,52 @@ static void decodeSixWide(int v, int width, int height, int *x, int *y)
 }
 
 
+// derived parameters of a grid record, computed once for all records on first use
+typedef struct {
+    signed char prelen, postlen;    // prefix and postfix length (of the encoded codex)
+    int divx, divy;                 // number of cells of the grid
+    int xgridsize, ygridsize;       // size of a cell
+    int dividerx, dividery;         // size of a postfix unit within a cell
+} gridInfoRec;
+
+static gridInfoRec gridInfo[NR_RECS];
+
+static void buildGridInfo(void)
+{
+    for (int m = 0; m < NR_RECS; m++) {
+        gridInfoRec *g = &gridInfo[m];
+        const mminforec *b = boundaries(m);
+        if (isNameless(m) || recType(m) > 1 || smartDiv(m) == 0)
+            continue; // not a grid (or, like the final Earth record, never used as one)
+
+        int codexm = coDex(m);
+        if (codexm == 21)
+            codexm = 22;
+        if (codexm == 14)
+            codexm = 23;
+        g->prelen = (signed char) (codexm / 10);
+        g->postlen = (signed char) (codexm % 10);
+
+        g->divy = smartDiv(m);
+        if (g->divy == 1) {
+            g->divx = xside[g->prelen];
+            g->divy = yside[g->prelen];
+        } else {
+            g->divx = (nc[g->prelen] / g->divy);
+        }
+
+        g->ygridsize = (b->maxy - b->miny + g->divy - 1) / g->divy; // lonlat per cell
+        g->xgridsize = (b->maxx - b->minx + g->divx - 1) / g->divx; // lonlat per cell
+        g->dividery = ((g->ygridsize) + yside[g->postlen] - 1) / yside[g->postlen];
+        g->dividerx = ((g->xgridsize) + xside[g->postlen] - 1) / xside[g->postlen];
+    }
+}
+
+static const gridInfoRec *gridInfoOf(int m)
+{
+    return &gridInfo[m];
+}
+
 // decodes dec->mapcode in context of territory rectangle m
 static int decodeGrid(decodeRec *dec, int m, int hasHeaderLetter)
 {
@@ -579,14 +1287,9 @@ static int decodeGrid(decodeRec *dec, int m, int hasHeaderLetter)
     }
 
     int postlen = codexlen - prelen;
-    int divx;
-    int divy = smartDiv(m);
-    if (divy == 1) {
-        divx = xside[prelen];
-        divy = yside[prelen];
-    } else {
-        divx = (nc[prelen] / divy);
-    }
+    const gridInfoRec *g = gridInfoOf(m); // prelen and postlen always match the record here
+    int divx = g->divx;
+    int divy = g->divy;
 
     if (prelen == 4 && divx == xside[4] && divy == yside[4]) {
         char t = result[1];
@@ -607,20 +1310,16 @@ static int decodeGrid(decodeRec *dec, int m, int hasHeaderLetter)
     }
 
     const mminforec *b = boundaries(m);
-    int ygridsize = (b->maxy - b->miny + divy - 1) / divy; // lonlat per cell
-    int xgridsize = (b->maxx - b->minx + divx - 1) / divx; // lonlat per cell
-
     if (relx < 0 || rely < 0 || relx >= divx || rely >= divy)
         return -111;
 
     // and then encode relative to THE CORNER of this cell
-    rely = b->miny + (rely * ygridsize);
-    relx = b->minx + (relx * xgridsize);
+    rely = b->miny + (rely * g->ygridsize);
+    relx = b->minx + (relx * g->xgridsize);
 
-    int xp = xside[postlen];
-    int dividerx = (((xgridsize)) + xp - 1) / xp;
     int yp = yside[postlen];
-    int dividery = (((ygridsize)) + yp - 1) / yp;
+    int dividerx = g->dividerx;
+    int dividery = g->dividery;
 
     // decoderelative
     char *r = result + prelen + 1;
@@ -659,43 +1358,25 @@ static void encodeGrid(char *result, const encodeRec *enc, int const m,
     int y = enc->lat32, x = enc->lon32;
     const mminforec *b = boundaries(m);
 
+    const gridInfoRec *g = gridInfoOf(m);
     int orgcodex = coDex(m);
-    int codexm = orgcodex;
-    if (codexm == 21)
-        codexm = 22;
-
-    if (codexm == 14)
-        codexm = 23;
 
     *result = 0;
     if (headerLetter)
         result++;
 
-    int prelen = codexm / 10;
-    int postlen = codexm % 10;
-
-    int divx;
-    int divy = smartDiv(m);
-    if (divy == 1) {
-        divx = xside[prelen];
-        divy = yside[prelen];
-    } else {
-        divx = (nc[prelen] / divy);
-    }
+    int prelen = g->prelen;
+    int postlen = g->postlen;
+    int divx = g->divx;
+    int divy = g->divy;
 
     // grid
-    int ygridsize = (b->maxy - b->miny + divy - 1) / divy;
-    int xgridsize = (b->maxx - b->minx + divx - 1) / divx;
+    int ygridsize = g->ygridsize;
+    int xgridsize = g->xgridsize;
+    if (x < b->minx || x >= b->maxx) // 1.32 fix FIJI edge case: x is in the second x-range of the record
+        x += recordBounds.xwrap[m];
     int rely = y - b->miny;
     int relx = x - b->minx;
-
-    if (relx < 0) {
-        relx += 360000000;
-        x += 360000000;
-    } else if (relx >= 360000000) { // 1.32 fix FIJI edge case
-        relx -= 360000000;
-        x -= 360000000;
-    }
     rely /= ygridsize;
     relx /= xgridsize;
 
@@ -720,8 +1401,8 @@ static void encodeGrid(char *result, const encodeRec *enc, int const m,
     relx = b->minx + (relx * xgridsize);
 
     // postfix
-    int dividery = (((ygridsize)) + yside[postlen] - 1) / yside[postlen];
-    int dividerx = (((xgridsize)) + xside[postlen] - 1) / xside[postlen];
+    int dividery = g->dividery;
+    int dividerx = g->dividerx;
 
     char *resultptr = result + prelen;
     *resultptr++ = '.';
@@ -787,6 +1468,72 @@ static int countNamelessRecords(int m, int firstcode)
 }
 
 
+// derived parameters of a nameless record, computed once for all records on first use
+typedef struct {
+    int first;                  // first nameless record of the same codex in the territory (F)
+    int count;                  // number of nameless records of the same codex (A)
+    int storageOffset;          // first value of this record (which is record F+X)
+    int basePowerA;             // values per record, if there are many records (A>=62) or the codex is 21
+    int side, xside;            // SIDE and xSIDE (set for every record, see isSpecialShape22)
+} namelessInfoRec;
+
+static namelessInfoRec namelessInfo[NR_RECS];
+
+static void buildNamelessInfo(void)
+{
+    for (int m = 0; m < NR_RECS; m++) {
+        namelessInfoRec *n = &namelessInfo[m];
+        const mminforec *b = boundaries(m);
+        n->side = n->xside = smartDiv(m);
+        if (isSpecialShape22(m)) { //  - keep the existing rectangle!
+            n->side = 1 + ((b->maxy - b->miny) / 90); // new side, based purely on y-distance
+            n->xside = (smartDiv(m) * smartDiv(m)) / n->side;
+        }
+    }
+
+    for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+        for (int m = firstrec(ccode); m <= lastrec(ccode); m++) {
+            namelessInfoRec *n = &namelessInfo[m];
+            if (!isNameless(m))
+                continue;
+
+            int codexm = coDex(m);
+            int A = countNamelessRecords(m, firstrec(ccode));
+            int X = m - firstNamelessRecord(m, firstrec(ccode));
+            n->first = m - X;
+            n->count = A;
+
+            int p = 31 / A;
+            int r = 31 % A; // the first r items are p+1
+            if (codexm != 21 && A <= 31) {
+                n->storageOffset = (X * p + (X < r ? X : r)) * (961 * 961); // p=4,r=3: offset(X)={0,5,10,15,19,23,27}-31
+            } else if (codexm != 21 && A < 62) {
+                if (X < (62 - A)) {
+                    n->storageOffset = X * (961 * 961);
+                } else {
+                    n->storageOffset = (62 - A + ((X - 62 + A) / 2)) * (961 * 961);
+                    if ((X + A) & 1)
+                        n->storageOffset += (16 * 961 * 31);
+                }
+            } else {
+                int BASEPOWER = (codexm == 21) ? 961 * 961 : 961 * 961 * 31;
+                n->basePowerA = (BASEPOWER / A);
+                if (A == 62)
+                    n->basePowerA++;
+                else
+                    n->basePowerA = (961) * (n->basePowerA / 961);
+                n->storageOffset = X * n->basePowerA;
+            }
+        }
+    }
+}
+
+static const namelessInfoRec *namelessInfoOf(int m)
+{
+    return &namelessInfo[m];
+}
+
+
 // decodes dec->mapcode in context of territory rectangle m, territory dec->context
 // Returns negative in case of error
 static int decodeNameless(decodeRec *dec, int m)
@@ -804,8 +1551,9 @@ static int decodeNameless(decodeRec *dec, int m)
     strcpy(input, dec->mapcode);
     strcpy(input + dc, dec->mapcode + dc + 1);
 
-    A = countNamelessRecords(m, firstrec(dec->context));
-    F = firstNamelessRecord(m, firstrec(dec->context));
+    const namelessInfoRec *n = namelessInfoOf(m);
+    A = n->count;
+    F = n->first;
 
     int p = 31 / A;
     int r = 31 % A;
@@ -835,13 +1583,7 @@ static int decodeNameless(decodeRec *dec, int m)
             X = X + (X - (62 - A));
         }
     } else { // code==21 || A>=62
-        int BASEPOWER = (codexm == 21) ? 961 * 961 : 961 * 961 * 31;
-        int BASEPOWERA = (BASEPOWER / A);
-
-        if (A == 62)
-            BASEPOWERA++;
-        else
-            BASEPOWERA = 961 * (BASEPOWERA / 961);
+        int BASEPOWERA = n->basePowerA;
 
         v = decodeBase31(result);
         X = (v / BASEPOWERA);
@@ -872,14 +1614,9 @@ static int decodeNameless(decodeRec *dec, int m)
     }
 
     m = (F + X);
-    int SIDE = smartDiv(m);
-    int xSIDE = SIDE;
+    int SIDE = namelessInfoOf(m)->side;
+    int xSIDE = namelessInfoOf(m)->xside;
     const mminforec *b = boundaries(m);
-    if (isSpecialShape22(m)) {
-        xSIDE *= SIDE;
-        SIDE = 1 + ((b->maxy - b->miny) / 90); // side purely on y range
-        xSIDE = xSIDE / SIDE;
-    }
 
     // decode
     int dx, dy;
@@ -903,6 +1640,7 @@ static int decodeNameless(decodeRec *dec, int m)
 
 #ifdef SUPPORT_HIGH_PRECISION
     dec->lon += ((dx * dividerx4) % 4) / 4.0;
+    dec->lonNano += ((dx * dividerx4) % 4) * 250;
 #endif
 
     return err;
@@ -1002,60 +1740,29 @@ static int unpack_if_alldigits(char *input) // returns 1 if unpacked, 0 if left
 
 
 // returns -1 (error), or m (also returns *result!=0 in case of success)
-static int encodeNameless(char *result, const encodeRec *enc,
-    int input_ctry, int extraDigits, int m)
+static int encodeNameless(char *result, const encodeRec *enc, int extraDigits, int m)
 {
-    // determine how many nameless records there are (A), and which one is this (X)...
+    // how many nameless records there are (A), and where this one (X) is stored
     int y = enc->lat32, x = enc->lon32;
-    int A = countNamelessRecords(m, firstrec(input_ctry));
-    int X = m - firstNamelessRecord(m, firstrec(input_ctry));
+    const namelessInfoRec *n = namelessInfoOf(m);
+    int A = n->count;
 
     *result = 0;
-    int p = 31 / A;
-    int r = 31 % A; // the first r items are p+1
-
     int codexm = coDex(m);
     int codexlen = (codexm / 10) + (codexm % 10);
-    int storage_offset;
-    if (codexm != 21 && A <= 31) {
-        storage_offset = (X * p + (X < r ? X : r)) * (961 * 961); // p=4,r=3: offset(X)={0,5,10,15,19,23,27}-31
-    } else if (codexm != 21 && A < 62) {
-        if (X < (62 - A)) {
-            storage_offset = X * (961 * 961);
-        } else {
-            storage_offset = (62 - A + ((X - 62 + A) / 2)) * (961 * 961);
-            if ((X + A) & 1)
-                storage_offset += (16 * 961 * 31);
-        }
-    } else {
-        int BASEPOWER = (codexm == 21) ? 961 * 961 : 961 * 961 * 31;
-        int BASEPOWERA = (BASEPOWER / A);
-        if (A == 62)
-            BASEPOWERA++;
-        else
-            BASEPOWERA = (961) * (BASEPOWERA / 961);
-        storage_offset = X * BASEPOWERA;
-    }
+    int storage_offset = n->storageOffset;
 
     // determine side of square around centre
-    int SIDE = smartDiv(m);
-    int xSIDE = SIDE;
-    int orgSIDE = SIDE;
+    int SIDE = n->side;
+    int xSIDE = n->xside;
+    int orgSIDE = smartDiv(m);
     const mminforec *b = boundaries(m);
-    if (isSpecialShape22(m)) { //  - keep the existing rectangle!
-        SIDE = 1 + ((b->maxy - b->miny) / 90); // new side, based purely on y-distance
-        xSIDE = (orgSIDE * orgSIDE) / SIDE;
-    }
 
     if (fitsInside(x, y, m)) {
         int v = storage_offset;
 
         int dividerx4 = xDivider4(b->miny, b->maxy); // *** note: dividerx4 is 4 times too large!
-#ifdef SUPPORT_HIGH_PRECISION // precise encoding: take fraction into account!
-        int xFracture = (int) (4 * enc->fraclon);
-#else
-        int xFracture = 0;
-#endif
+        int xFracture = (int) (enc->fixedlon >> (FRACTION_BITS - 2)); // precise encoding: take fraction into account!
         int dx = (4 * (x - b->minx) + xFracture) / dividerx4; // like div, but with floating point value
         int extrax4 = (x - b->minx) * 4 - dx * dividerx4; // like modulus, but with floating point value
 
@@ -1063,15 +1770,14 @@ static int encodeNameless(char *result, const encodeRec *enc,
         int dy = (b->maxy - y) / dividery;  // between 0 and SIDE-1
         int extray = (b->maxy - y) % dividery;
 
-#ifdef SUPPORT_HIGH_PRECISION // precise encoding: check if fraction takes this out of range
-        if (extray == 0 && enc->fraclat > 0) {
+        // precise encoding: check if fraction takes this out of range
+        if (extray == 0 && enc->fixedlat > 0) {
             if (dy == 0)
                 return -1; // fraction takes this coordinate out of range
 
             dy--;
             extray += dividery;
         }
-#endif
         if (isSpecialShape22(m))
             v += encodeSixWide(dx, SIDE - 1 - dy, xSIDE, SIDE);
         else
@@ -1102,142 +1808,228 @@ static int encodeNameless(char *result, const encodeRec *enc,
 }
 
 
-// decodes dec->mapcode in context of territory rectangle m
-static int decodeAutoHeader(decodeRec *dec, int m)
-{
-    const char *input = dec->mapcode;
-    int codexm = coDex(m);
-    char *dot = strchr(input, '.');
-
-    int STORAGE_START = 0;
-
-    if (dot == NULL)
-        return -201;
+// derived parameters of an auto-header record, computed once for all records on first use
+typedef struct {
+    int storageStart;               // first value of this record, counted from the first record of its group
+    int product;                    // number of values of this record
+    int W, H;                       // number of cells (multiples of 168 and 176)
+    int dividerx, dividery;         // size of a cell
+    int last;                       // last record of the group
+} autoHeaderInfoRec;
 
-    int value = decodeBase31(input); // decode top
-    value *= (961 * 31);
+static autoHeaderInfoRec autoHeaderInfo[NR_RECS];
 
-    for (; coDex(m) == codexm && recType(m) > 1; m++) {
+static void buildAutoHeaderInfo(void)
+{
+    int STORAGE_START = 0;
+    for (int m = 0; m < NR_RECS; m++) {
+        autoHeaderInfoRec *h = &autoHeaderInfo[m];
         const mminforec *b = boundaries(m);
+        int codexm = coDex(m);
+        if (recType(m) <= 1)
+            continue;
+        if (m == 0 || recType(m - 1) <= 1 || coDex(m - 1) != codexm) // first of a group?
+            STORAGE_START = 0;
+
         // determine how many cells
         int H = (b->maxy - b->miny + 89) / 90; // multiple of 10m
         int xdiv = xDivider4(b->miny, b->maxy);
         int W = ((b->maxx - b->minx) * 4 + (xdiv - 1)) / xdiv;
-        int product;
 
-        // decode
+        // round up to multiples of 176*168...
         H = 176 * ((H + 176 - 1) / 176);
         W = 168 * ((W + 168 - 1) / 168);
-        product = (W / 168) * (H / 176) * 961 * 31;
-
-        if (recType(m) == 2) {
-            int GOODROUNDER = coDex(m) >= 23 ? (961 * 961 * 31) : (961 * 961);
+        int product = (W / 168) * (H / 176) * 961 * 31;
+        if (recType(m) == 2) { // plus pipe
+            int GOODROUNDER = codexm >= 23 ? (961 * 961 * 31) : (961 * 961);
             product = ((STORAGE_START + product + GOODROUNDER - 1) / GOODROUNDER) * GOODROUNDER - STORAGE_START;
         }
 
-        if (value >= STORAGE_START && value < STORAGE_START + product) {
-            int dividerx = (b->maxx - b->minx + W - 1) / W;
-            int dividery = (b->maxy - b->miny + H - 1) / H;
+        h->storageStart = STORAGE_START;
+        h->product = product;
+        h->W = W;
+        h->H = H;
+        h->dividerx = (b->maxx - b->minx + W - 1) / W;
+        h->dividery = (b->maxy - b->miny + H - 1) / H;
+        STORAGE_START += product;
+    }
+    for (int m = NR_RECS - 1; m >= 0; m--) {
+        if (recType(m) <= 1)
+            continue;
+        if (m + 1 < NR_RECS && recType(m + 1) > 1 && coDex(m + 1) == coDex(m))
+            autoHeaderInfo[m].last = autoHeaderInfo[m + 1].last;
+        else
+            autoHeaderInfo[m].last = m;
+    }
+}
+
+static const autoHeaderInfoRec *autoHeaderInfoOf(int m)
+{
+    return &autoHeaderInfo[m];
+}
 
-            value -= STORAGE_START;
-            value /= (961 * 31);
+// decodes dec->mapcode in the group of auto-header records starting with m
+static int decodeAutoHeader(decodeRec *dec, int m)
+{
+    const char *input = dec->mapcode;
+    char *dot = strchr(input, '.');
 
-            int difx, dify;
-            decode_triple(dot + 1, &difx, &dify); // decode bottom 3 chars
-            int vx = (value / (H / 176)) * 168 + difx; // is vx/168
-            int vy = (value % (H / 176)) * 176 + dify; // is vy/176
+    if (dot == NULL)
+        return -201;
 
-            dec->lat32 = b->maxy - vy * dividery;
-            dec->lon32 = b->minx + vx * dividerx;
-            if (dec->lon32 < b->minx || dec->lon32 >= b->maxx || dec->lat32 < b->miny ||
-                dec->lat32 > b->maxy) // *** CAREFUL! do this test BEFORE adding remainder...
-                return -122; // invalid code
+    int value = decodeBase31(input); // decode top
+    value *= (961 * 31);
 
-            return decodeExtension(dec, dividerx << 2, dividery, -1); // autoheader decode
-        }
-        STORAGE_START += product;
-    } // for j
-    return -1;
+    // find the last record of the group that starts at or before value
+    int lo = m;
+    int hi = autoHeaderInfoOf(m)->last;
+    if (value < autoHeaderInfo[lo].storageStart)
+        return -1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (autoHeaderInfo[mid].storageStart <= value)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    m = lo;
+
+    const autoHeaderInfoRec *h = &autoHeaderInfo[m];
+    if (value >= h->storageStart + h->product)
+        return -1;
+
+    const mminforec *b = boundaries(m);
+    int H = h->H;
+    int dividerx = h->dividerx;
+    int dividery = h->dividery;
+
+    value -= h->storageStart;
+    value /= (961 * 31);
+
+    int difx, dify;
+    decode_triple(dot + 1, &difx, &dify); // decode bottom 3 chars
+    int vx = (value / (H / 176)) * 168 + difx; // is vx/168
+    int vy = (value % (H / 176)) * 176 + dify; // is vy/176
+
+    dec->lat32 = b->maxy - vy * dividery;
+    dec->lon32 = b->minx + vx * dividerx;
+    if (dec->lon32 < b->minx || dec->lon32 >= b->maxx || dec->lat32 < b->miny ||
+        dec->lat32 > b->maxy) // *** CAREFUL! do this test BEFORE adding remainder...
+        return -122; // invalid code
+
+    return decodeExtension(dec, dividerx << 2, dividery, -1); // autoheader decode
 }
 
 // encode in m (know to fit)
 static int encodeAutoHeader(char *result, const encodeRec *enc, int m, int extraDigits)
 {
-    int i;
-    int STORAGE_START = 0;
     int y = enc->lat32, x = enc->lon32;
-
-    // search back to first of the group
-    int firstindex = m;
+    const autoHeaderInfoRec *h = autoHeaderInfoOf(m);
+    const mminforec *b = boundaries(m);
     int codexm = coDex(m);
-    while (recType(firstindex - 1) > 1 && coDex(firstindex - 1) == codexm)
-        firstindex--;
+    int H = h->H;
 
-    for (i = firstindex; coDex(i) == codexm; i++) {
-        int W, H, xdiv, product;
-        const mminforec *b = boundaries(i);
-        // determine how many cells
-        H = (b->maxy - b->miny + 89) / 90; // multiple of 10m
-        xdiv = xDivider4(b->miny, b->maxy);
-        W = ((b->maxx - b->minx) * 4 + (xdiv - 1)) / xdiv;
+    // encode
+    int dividerx = h->dividerx;
+    int vx = (x - b->minx) / dividerx;
+    int extrax = (x - b->minx) % dividerx;
 
-        // encodee
-        // round up to multiples of 176*168...
-        H = 176 * ((H + 176 - 1) / 176);
-        W = 168 * ((W + 168 - 1) / 168);
-        product = (W / 168) * (H / 176) * 961 * 31;
-        if (recType(i) == 2) { // plus pipe
-            int GOODROUNDER = codexm >= 23 ? (961 * 961 * 31) : (961 * 961);
-            product = ((STORAGE_START + product + GOODROUNDER - 1) / GOODROUNDER) * GOODROUNDER - STORAGE_START;
-        }
+    int dividery = h->dividery;
+    int vy = (b->maxy - y) / dividery;
+    int extray = (b->maxy - y) % dividery;
 
-        if (i == m) {
-            // encode
-            int dividerx = (b->maxx - b->minx + W - 1) / W;
-            int vx = (x - b->minx) / dividerx;
-            int extrax = (x - b->minx) % dividerx;
+    int codexlen = (codexm / 10) + (codexm % 10);
+    int value = (vx / 168) * (H / 176);
+
+    // precise encoding: check if fraction takes this out of range
+    if (extray == 0 && enc->fixedlat > 0) {
+        if (vy == 0)
+            return -1; // fraction takes this coordinate out of range
+        vy--;
+        extray += dividery;
+    }
+    value += (vy / 176);
 
-            int dividery = (b->maxy - b->miny + H - 1) / H;
-            int vy = (b->maxy - y) / dividery;
-            int extray = (b->maxy - y) % dividery;
+    // PIPELETTER ENCODE
+    encodeBase31(result, (h->storageStart / (961 * 31)) + value, codexlen - 2);
+    result[codexlen - 2] = '.';
+    encode_triple(result + codexlen - 1, vx % 168, vy % 176);
 
-            int codexlen = (codexm / 10) + (codexm % 10);
-            int value = (vx / 168) * (H / 176);
+    encodeExtension(result, extrax << 2, extray, dividerx << 2, dividery, extraDigits, -1, enc); // autoheader
+    return m;
+}
 
-#ifdef SUPPORT_HIGH_PRECISION // precise encoding: check if fraction takes this out of range
-            if (extray == 0 && enc->fraclat > 0) {
-                if (vy == 0) {
-                    STORAGE_START += product;
-                    continue;
-                }
-                vy--;
-                extray += dividery;
-            }
-#endif
-            value += (vy / 176);
 
-            // PIPELETTER ENCODE
-            encodeBase31(result, (STORAGE_START / (961 * 31)) + value, codexlen - 2);
-            result[codexlen - 2] = '.';
-            encode_triple(result + codexlen - 1, vx % 168, vy % 176);
+static int debugStopAt = -1;
+
+// returns the earth record that covers latitude y (the earth records, except the last, are consecutive latitude bands)
+static int earthRecordOf(int y)
+{
+    int lo = firstrec(ccode_earth);
+    int hi = lastrec(ccode_earth) - 1; // the last earth record is never used for encoding
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (y < mminfo[mid].maxy)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
 
-            encodeExtension(result, extrax << 2, extray, dividerx << 2, dividery, extraDigits, -1, enc); // autoheader
-            return m;
+// encodes enc in record i (known to fit); result_counter is the number of earlier results in the same territory
+static void encodeInRecord(char *result, const encodeRec *enc, int i, int extraDigits, int result_counter)
+{
+    if (isNameless(i)) {
+        encodeNameless(result, enc, extraDigits, i);
+    }
+    else if (recType(i) > 1) {
+        encodeAutoHeader(result, enc, i, extraDigits);
+    } else { // must be grid
+        // skip isRestricted records unless there already is a result
+        if (result_counter > 0 || !isRestricted(i)) {
+            char headerletter = (char) ((recType(i) == 1) ? headerLetter(i) : 0);
+            encodeGrid(result, enc, i, extraDigits, headerletter);
         }
-        STORAGE_START += product;
     }
-    return i - 1; // return last autoheader record as the (failing) record
 }
 
+// adds result, for territory cc, to the mapcodes of enc
+static void addResult(const encodeRec *enc, const char *result, int cc)
+{
+    if (*result && enc->mapcodes && enc->mapcodes->count < MAX_NR_OF_MAPCODE_RESULTS) {
+        char *s = enc->mapcodes->mapcode[enc->mapcodes->count++];
+        if (cc == ccode_earth) {
+            strcpy(s, result);
+        } else {
+            getTerritoryIsoName(s, cc + 1, 0);
+            strcat(s, " ");
+            strcat(s, result);
+        }
+    }
+}
 
-static int debugStopAt = -1;
-
-static void encoderEngine(int ccode, const encodeRec *enc, int stop_with_one_result,
-    int extraDigits, int result_override)
+// remembers that record i contains the point, when encoding in territory ccode (for result_override)
+static void addTrajectoryRecord(TrajectoryEncoder *trajectory, int ccode, int i, int result_override)
 {
-    if (enc == NULL || ccode < 0 || ccode > ccode_earth)
-        return; // bad arguments
+    int n = trajectory->count;
+    if (n < 0)
+        return;
+    if (n >= MAX_TRAJECTORY_RECORDS) {
+        trajectory->count = -1; // too many to remember
+        return;
+    }
+    trajectory->record[n] = (short) i;
+    trajectory->territory[n] = (short) ccode;
+    trajectory->override[n] = (short) result_override;
+    trajectory->count = n + 1;
+}
 
+// encodes enc in territory ccode, trying only the records in candidates (or, if NULL, those from the territory index);
+// returns the country to continue encoding in if x,y is in the last record of a subdivision that refers to it, or -1
+static int encodeInRecords(int ccode, const encodeRec *enc, int stop_with_one_result,
+    int extraDigits, int result_override, const recmask *candidates)
+{
     int from = firstrec(ccode);
     int upto = lastrec(ccode);
     int x = enc->lon32;
@@ -1245,7 +2037,7 @@ static void encoderEngine(int ccode, const encodeRec *enc, int stop_with_one_res
 
     if (ccode != ccode_earth)
         if (!fitsInside(x, y, upto))
-            return;
+            return -1;
 
     ///////////////////////////////////////////////////////////
     // look for encoding options
@@ -1254,275 +2046,619 @@ static void encoderEngine(int ccode, const encodeRec *enc, int stop_with_one_res
     *result = 0;
     int result_counter = 0;
 
-    for (int i = from; i <= upto; i++) {
-        if (coDex(i) < 54) {
-            if (fitsInside(x, y, i)) {
-                if (isNameless(i)) {
-                    int ret = encodeNameless(result, enc, ccode, extraDigits, i);
-                    if (ret >= 0) {
-                        i = ret;
-                    }
-                }
-                else if (recType(i) > 1) {
-                    encodeAutoHeader(result, enc, i, extraDigits);
-                // if the last item is a reference to a state's country
-                } else if (i == upto && isRestricted(i) && isSubdivision(ccode)) {
-                    // *** do a recursive call for the parent ***
-                    encoderEngine(ParentTerritoryOf(ccode), enc, stop_with_one_result, extraDigits, ccode);
-                    return;
-                } else { // must be grid
-                    // skip isRestricted records unless there already is a result
-                    if (result_counter > 0 || !isRestricted(i)) {
-                        char headerletter = (char) ((recType(i) == 1) ? headerLetter(i) : 0);
-                        encodeGrid(result, enc, i, extraDigits, headerletter);
-                    }
-                }
 
-                // =========== handle result (if any)
-                if (*result) {
-                    result_counter++;
-
-                    repack_if_alldigits(result, 0);
-
-                    if (debugStopAt < 0 || debugStopAt == i) {
-                        int cc = (result_override >= 0 ? result_override : ccode);
-                        if (*result && enc->mapcodes && enc->mapcodes->count < MAX_NR_OF_MAPCODE_RESULTS) {
-                            char *s = enc->mapcodes->mapcode[enc->mapcodes->count++];
-                            if (cc == ccode_earth) {
-                                strcpy(s, result);
-                            } else {
-                                getTerritoryIsoName(s, cc + 1, 0);
-                                strcat(s, " ");
-                                strcat(s, result);
-                            }
-                        }
-                        if (debugStopAt == i)
-                            return;
-                    }
-                    if (stop_with_one_result)
-                        return;
-                    *result = 0; // clear for next iteration
+    // only visit the records that overlap the index cell of x,y (in their original order)
+    recmask band;
+    if (candidates == NULL) {
+        if (ccode == ccode_earth) { // international: only one latitude band can contain x,y
+            band = ((recmask) 1) << (earthRecordOf(y) - from);
+            candidates = &band;
+        } else {
+            candidates = territoryCandidates(ccode, x, y);
+        }
+    }
+    const int words = territoryIndex[ccode].words;
+
+    for (int w = 0; w < words; w++) {
+        if (candidates[w] == 0)
+            continue;
+        recmask hits = containedIn(&recordBounds, x, y, from + w * RECMASK_BITS, candidates[w]);
+        for (; hits != 0; hits &= hits - 1) {
+            int i = from + w * RECMASK_BITS + lowestBit(hits);
+            // if the last item is a reference to a state's country
+            if (i == upto && territoryIndex[ccode].parent >= 0) {
+                // *** continue with the parent ***
+                return territoryIndex[ccode].parent;
+            }
+            if (enc->trajectory)
+                addTrajectoryRecord(enc->trajectory, ccode, i, result_override);
+            encodeInRecord(result, enc, i, extraDigits, result_counter);
+
+            // =========== handle result (if any)
+            if (*result) {
+                result_counter++;
+
+                repack_if_alldigits(result, 0);
+
+                if (debugStopAt < 0 || debugStopAt == i) {
+                    addResult(enc, result, (result_override >= 0 ? result_override : ccode));
+                    if (debugStopAt == i)
+                        return -1;
                 }
+                if (stop_with_one_result)
+                    return -1;
+                *result = 0; // clear for next iteration
             }
         }
-    } // for i
+    } // for w
+    return -1;
 }
 
-
-// returns nonzero if error
-static int decoderEngine(decodeRec *dec)
+static void encoderEngine(int ccode, const encodeRec *enc, int stop_with_one_result,
+    int extraDigits, int result_override, const recmask *candidates)
 {
-    int parentcode;
-    int err;
-    int ccode, len;
-    char *minus;
-    const char *iso3;
-    char *s = dec->minput;
+    if (enc == NULL || ccode < 0 || ccode > ccode_earth)
+        return; // bad arguments
 
-    // copy input, cleaned of leading and trailing whitespace, into private, non-const buffer
-    const char *r = dec->orginput;
-    while (*r > 0 && *r <= 32)
-        r++; // skip lead
+    int parent = encodeInRecords(ccode, enc, stop_with_one_result, extraDigits, result_override, candidates);
+    if (parent >= 0)
+        encodeInRecords(parent, enc, stop_with_one_result, extraDigits, ccode, NULL);
+}
 
-    len = (int) strlen(r);
-    if (len > MAX_MAPCODE_RESULT_LEN - 1)
-        len = MAX_MAPCODE_RESULT_LEN - 1;
-    while (len > 0 && r[len - 1] >= 0 && r[len - 1] <= 32)
-        len--; // remove trail
-    memcpy(s, r, len);
-    s[len] = 0;
 
-    // make input (excluding territory) uppercase, and replace digits 0 and 1 with O and I
-    char *t = strchr(s, ' ');
-    if (t == NULL)
-        t = s;
+// The parts of a mapcode string (territory, proper mapcode and extension), as recognised by the format check.
 
-    for (; *t != 0; t++) {
-        if (*t >= 'a' && *t <= 'z')
-            *t += ('A' - 'a');
-        if (*t == 'O')
-            *t = '0';
-        if (*t == 'I')
-            *t = '1';
-    }
+#define TOKENSEP   0
+#define TOKENDOT   1
+#define TOKENCHR   2
+#define TOKENVOWEL 3
+#define TOKENZERO  4
+#define TOKENHYPH  5
 
-    // check if extension, determine length without extension
-    minus = strchr(s + 4, '-');
-    if (minus)
-        len = (int) (minus - s);
 
-    // make sure there is valid context
-    iso3 = convertTerritoryCodeToIsoName(dec->context, 0); // get context string (or empty string)
-    if (*iso3 == 0)
-        iso3 = "AAA";
-    parentcode = disambiguate_str(iso3, (int) strlen(iso3)); // pass for future context disambiguation
-
-    // insert context if none in input
-    if (len > 0 && len <= 9 && strchr(s, ' ') == 0) { // just a non-international mapcode without a territory code?
-        int ilen = (int) strlen(iso3);
-        memmove(s + ilen + 1, s, strlen(s) + 1);
-        s[ilen] = ' ';
-        memcpy(s, iso3, ilen);
-        len += (1 + ilen);
-        iso3 = "";
-    }
-    // parse off extension
-    s[len] = 0;
-    if (minus)
-        dec->extension = &s[len + 1];
-    else
-        dec->extension = "";
+#define ERR -1
+#define Prt -9 // partial
+#define GO  99
 
-    // now split off territory, make point to start of proper mapcode
-    // assume ISO3 space|minus ISO23 space MAPCODE
-    if (len > 8 && (s[3] == ' ' || s[3] == '-') && (s[6] == ' ' || s[7] == ' ')) {
-        parentcode = disambiguate_str(s, 3);
-        if (parentcode < 0)
-            return parentcode;
+static signed char fullmc_statemachine[23][6] = {
+        // WHI DOT DET VOW ZER HYP
+        /* 0 start        */ {0,   ERR, 1,  1,    ERR, ERR}, // looking for very first detter
+        /* 1 gotL         */ {ERR, ERR, 2,  2,    ERR, ERR}, // got one detter, MUST get another one
+        /* 2 gotLL        */ {18,  6,   3,  3,    ERR, 14},  // GOT2: white: got territory + start prefix | dot: 2.X mapcode | det:3letter | hyphen: 2-state
+        /* 3 gotLLL       */ {18,  6,   4,   ERR, ERR, 14},  // white: got territory + start prefix | dot: 3.X mapcode | det:4letterprefix | hyphen: 3-state
+        /* 4 gotprefix4   */ {ERR, 6,   5,   ERR, ERR, ERR}, // dot: 4.X mapcode | det: got 5th prefix letter
+        /* 5 gotprefix5   */ {ERR, 6,   ERR, ERR, ERR, ERR}, // got 5char so MUST get dot!
+        /* 6 prefix.      */ {ERR, ERR, 7,  7,    Prt, ERR}, // MUST get first letter after dot
+        /* 7 prefix.L     */ {ERR, ERR, 8,  8,    Prt, ERR}, // MUST get second letter after dot
+        /* 8 prefix.LL    */ {22,  ERR, 9,  9,    GO,  11},  // get 3d letter after dot | X.2- | X.2 done!
+        /* 9 prefix.LLL   */ {22,  ERR, 10, 10,   GO,  11},  // get 4th letter after dot | X.3- | X.3 done!
+        /*10 prefix.LLLL  */ {22,  ERR, ERR, ERR, GO,  11},  // X.4- | x.4 done!
+        /*11 mc-          */ {ERR, ERR, 12,  ERR, Prt, ERR}, // MUST get first precision letter
+        /*12 mc-L         */ {22,  ERR, 13,  ERR, GO,  ERR}, // Get 2nd precision letter | done X.Y-1
+        /*13 mc-LL*       */ {22,  ERR, 13,  ERR, GO,  ERR}, // *** keep reading precision detters *** until whitespace or done
+        /*14 ctry-        */ {ERR, ERR, 15, 15,   ERR, ERR}, // MUST get first state letter
+        /*15 ctry-L       */ {ERR, ERR, 16, 16,   ERR, ERR}, // MUST get 2nd state letter
+        /*16 ctry-LL      */ {18,  ERR, 17, 17,   ERR, ERR}, // white: got CCC-SS and get prefix | got 3d letter
+        /*17 ctry-LLL     */ {18,  ERR, ERR, ERR, ERR, ERR}, // got CCC-SSS so MUST get whitespace and then get prefix
+        /*18 startprefix  */ {18,  ERR, 19, 19,   ERR, ERR}, // skip more whitespace, MUST get 1st prefix letter
+        /*19 gotprefix1   */ {ERR, ERR, 20,  ERR, ERR, ERR}, // MUST get second prefix letter
+        /*20 gotprefix2   */ {ERR, 6,   21,  ERR, ERR, ERR}, // dot: 2.X mapcode | det: 3d perfix letter
+        /*21 gotprefix3   */ {ERR, 6,   4,   ERR, ERR, ERR}, // dot: 3.x mapcode | det: got 4th prefix letter
+        /*22 whitespace   */ {22,  ERR, ERR, ERR, GO,  ERR}  // whitespace until end of string
+};
 
-        s += 4;
-        len -= 4;
-    } else {
-        // assume ISO2 space|minus ISO23 space MAPCODE
-        if (len > 7 && (s[2] == ' ' || s[2] == '-') && (s[5] == ' ' || s[6] == ' ')) {
-            parentcode = disambiguate_str(s, 2);
-            if (parentcode < 0)
-                return parentcode;
+typedef struct {
+    const char *parent;       // parent territory of a subdivision, e.g. "USA" in "USA-CA 49.4V" (or NULL)
+    int parentLength;
+    const char *territory;    // territory, e.g. "CA" in "USA-CA 49.4V" (or NULL)
+    int territoryLength;
+    const char *mapcode;      // proper mapcode, e.g. "49.4V"
+    int mapcodeLength;
+    int prefixLength;         // characters before the dot
+    const char *extension;    // extension, without its hyphen (or NULL)
+    int extensionLength;
+    int vowels;               // vowels in the proper mapcode (or negative if the mapcode was not checked)
+    const char *normaliseFrom; // characters from here on are read in uppercase, with digits 0 and 1 for O and I
+} mapcodeTokens;
+
+// runs fullmc_statemachine over s (which ends after len characters, or at a zero-terminator), and fills tok with the
+// parts it recognises; pass fullcode=1 to recognise territory and mapcode, pass fullcode=0 for a proper mapcode only
+// returns 0 if ok, negative in case of error (see compareWithMapcodeFormat)
+static int tokenizeMapcode(mapcodeTokens *tok, const char *s, size_t len, int fullcode)
+{
+    int nondigits = 0, vowels = 0;
+    int state = (fullcode ? 0 : 18); // initial state
+    const char *start = NULL; // first character of the part being read
 
-            s += 3;
-            len -= 3;
+    memset(tok, 0, sizeof(mapcodeTokens));
+    for (size_t i = 0; ; i++) {
+        int newstate, token;
+        const char *p = s + i;
+        char ch = (i < len ? *p : 0);
+        // recognise token: decode returns -2=a -3=e -4=0, 0..9 for digit or "o" or "i", 10..31 for char, -1 for illegal char
+        if (ch == '.') {
+            token = TOKENDOT;
+        } else if (ch == '-') {
+            token = TOKENHYPH;
+        } else if (ch == 0) {
+            token = TOKENZERO;
+        } else if (ch == ' ' || ch == '\t') {
+            token = TOKENSEP;
+        } else {
+            signed char c = decode_chars[(unsigned char) ch];
+            if (c < 0) { // vowel or illegal?
+                token = TOKENVOWEL;
+                vowels++; // assume vowel (-2,-3,-4)
+                if (c == -1) { // illegal?
+                    return -4;
+                }
+            } else if (c < 10) { // digit
+                token = TOKENCHR; // digit
+            } else { // charcter B-Z
+                token = TOKENCHR;
+                if (state != 11 && state != 12 && state != 13) {
+                    nondigits++;
+                }
+            }
+        }
+        newstate = fullmc_statemachine[state][token];
+        if (newstate == ERR) {
+            return -(1000 + 10 * state + token);
+        } else if (newstate == Prt) {
+            return -999;
         }
-    }
 
-    // assume ISO whitespace MAPCODE, overriding iso3
-    if (len > 4 && s[3] == ' ') {
-        iso3 = s; // overrides iso code!
-        s += 4;
-        len -= 4;
-    } else if (len > 3 && s[2] == ' ') { // assume ISO2 whitespace MAPCODE, overriding iso3
-        iso3 = s; // overrides iso code!
-        s += 3;
-        len -= 3;
-    }
+        // note where the parts start and end
+        if ((state == 0 && newstate == 1) || (state == 18 && newstate == 19)) {
+            start = p; // territory or proper mapcode
+        } else if (newstate == 14 && state != 14) {
+            tok->parent = start;
+            tok->parentLength = (int) (p - start);
+            start = p + 1;
+        } else if (newstate == 18 && state != 18) {
+            tok->territory = start;
+            tok->territoryLength = (int) (p - start);
+            nondigits = vowels = 0;
+        } else if (newstate == 6) {
+            tok->mapcode = start;
+            tok->prefixLength = (int) (p - start);
+        } else if (state >= 8 && state <= 10 && (newstate == 11 || newstate == 22 || newstate == GO)) {
+            tok->mapcodeLength = (int) (p - tok->mapcode);
+        } else if (state == 11) {
+            tok->extension = p;
+        } else if (state >= 12 && state <= 13 && newstate != 13) {
+            tok->extensionLength = (int) (p - tok->extension);
+        }
 
-    // skip further whitespace
-    while (*s > 0 && *s <= 32) {
-        s++;
-        len--;
+        if (newstate == GO) {
+            tok->vowels = vowels;
+            tok->normaliseFrom = tok->mapcode;
+            return (nondigits ? (vowels > 0 ? -6 : 0) : (vowels > 0 && vowels <= 2 ? 0 : -5));
+        }
+        state = newstate;
     }
+}
 
-    // returns nonzero if error
-    // special case for mexico country vs state
-    ccode = ccode_of_iso3(iso3, parentcode);
-    if (ccode == ccode_mex && len < 8)
-        ccode = ccode_of_iso3("5MX", -1);
-
-    // master_decode(s,ccode)
-    // unpack digits (a-lead or aeu-encoded
-    int voweled = unpack_if_alldigits(s);
-    if (voweled < 0)
-        return -7;
-
-    // debug support: U-lead pre-processing
-    if (*s == 'u' || *s == 'U') {
-        s++;
-        len--;
-        voweled = 1;
+// splits s (of len characters) the lenient way, for input the format check does not accept: territory (if any)
+// followed by whitespace, proper mapcode, and everything after the first hyphen as extension
+static void splitMapcodeInput(mapcodeTokens *tok, const char *s, int len)
+{
+    const char *end = s + len;
+    const char *space = (const char *) memchr(s, ' ', len);
+    const char *minus = NULL;
+    for (const char *c = s + 4; c < end; c++) {
+        if (*c == '-') {
+            minus = c;
+            break;
+        }
     }
+    if (minus)
+        len = (int) (minus - s);
 
-    if (len > 10)
-        return -8;
-
-    // find dot and check that all characters are valid
-    int nrd = 0; // nr of true digits
-    const char *dot = NULL; // dot position in input
-    for (r = s; *r != 0; r++) {
-        if (*r == '.') {
-            if (dot) {
-                return -5; // more than one dot
+    memset(tok, 0, sizeof(mapcodeTokens));
+    if (!(len > 0 && len <= 9 && space == NULL)) { // not just a non-international mapcode without a territory code?
+        // assume ISO3 space|minus ISO23 space MAPCODE
+        if (len > 8 && (s[3] == ' ' || s[3] == '-') && (s[6] == ' ' || s[7] == ' ')) {
+            tok->parent = s;
+            tok->parentLength = 3;
+            s += 4;
+            len -= 4;
+        } else {
+            // assume ISO2 space|minus ISO23 space MAPCODE
+            if (len > 7 && (s[2] == ' ' || s[2] == '-') && (s[5] == ' ' || s[6] == ' ')) {
+                tok->parent = s;
+                tok->parentLength = 2;
+                s += 3;
+                len -= 3;
             }
-            dot = r;
-        } else if (decodeChar(*r) < 0) { // invalid char?
-            return -4;
-        } else if (decodeChar(*r) < 10) { // digit?
-            nrd++;
+        }
+
+        // assume ISO whitespace MAPCODE, overriding context
+        if (len > 4 && s[3] == ' ') {
+            tok->territory = s; // overrides context!
+            tok->territoryLength = 3;
+            s += 4;
+            len -= 4;
+        } else if (len > 3 && s[2] == ' ') { // assume ISO2 whitespace MAPCODE, overriding context
+            tok->territory = s; // overrides context!
+            tok->territoryLength = 2;
+            s += 3;
+            len -= 3;
+        }
+
+        // skip further whitespace
+        while (len > 0 && *s > 0 && *s <= 32) {
+            s++;
+            len--;
         }
     }
-    if (dot == NULL)
-        return -2;
-    else if (!voweled && nrd + 1 == len) // everything but the dot is digit, so MUST be voweled!
-        return -998;
 
-//////////// AT THIS POINT, dot=FIRST DOT, input=CLEAN INPUT (no vowels) ilen=INPUT LENGTH
+    tok->mapcode = s;
+    tok->mapcodeLength = len;
+    if (minus) {
+        tok->extension = minus + 1;
+        tok->extensionLength = (int) (end - tok->extension);
+    }
+    tok->vowels = -1;
+    tok->normaliseFrom = (space ? space : s);
+}
 
-    // analyse input
-    int prelen = (int) (dot - s);
-    int postlen = len - 1 - prelen;
+
+// For every territory and every shape of mapcode (2 to 5 characters before the dot, 2 to 4 after it), the records
+// that can decode it, in their original order: header-grid records (which only match their header letter), up to and
+// including the first record that matches regardless of the header letter. So decoding needs no search.
+
+#define DECODE_SHAPES       12  // number of shapes: (prelen 2..5) x (postlen 2..4)
+
+#define DECODE_NONE         0   // no record decodes the shape
+#define DECODE_GRID         1
+#define DECODE_HEADER_GRID  2
+#define DECODE_NAMELESS     3
+#define DECODE_AUTO_HEADER  4
+
+typedef struct {
+    int rec;                // record to decode with (or -1)
+    char letter;            // header letter the mapcode must start with (or 0 for any)
+    char kind;              // DECODE_NONE, DECODE_GRID, DECODE_HEADER_GRID, DECODE_NAMELESS or DECODE_AUTO_HEADER
+} decodeShapeRec;
+
+static int decodeShapeStart[MAX_CCODE][DECODE_SHAPES];  // first entry of every shape of every territory in decodeShapes
+static decodeShapeRec decodeShapes[MAX_CCODE * DECODE_SHAPES + NR_RECS];
+
+// returns the kind of decoding record i does for mapcodes of shape prelen.postlen (except for header-grid records)
+static int decodeKindOf(int i, int prelen, int postlen)
+{
     int codex = prelen * 10 + postlen;
-    if (prelen < 2 || prelen > 5 || postlen < 2 || postlen > 4)
-        return -3;
+    int codexi = coDex(i);
+    if (recType(i) == 0 && !isNameless(i) && (codexi == codex || (codex == 22 && codexi == 21)))
+        return DECODE_GRID;
+    if (isNameless(i) && ((codexi == 21 && codex == 22) || (codexi == 22 && codex == 32) || (codexi == 13 && codex == 23)))
+        return DECODE_NAMELESS;
+    if (recType(i) >= 2 && postlen == 3 && prefixLength(i) + postfixLength(i) == prelen + 2)
+        return DECODE_AUTO_HEADER;
+    return DECODE_NONE;
+}
+
+static void addDecodeShape(int *n, int rec, char letter, int kind)
+{
+    decodeShapes[*n].rec = rec;
+    decodeShapes[*n].letter = letter;
+    decodeShapes[*n].kind = (char) kind;
+    (*n)++;
+}
 
+static void buildDecodeShapes(void)
+{
+    int n = 0;
+    for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+        int from = firstrec(ccode);
+        int upto = lastrec(ccode);
+        for (int prelen = 2; prelen <= 5; prelen++) {
+            for (int postlen = 2; postlen <= 4; postlen++) {
+                int kind = DECODE_NONE;
+                int i;
+                decodeShapeStart[ccode][(prelen - 2) * 3 + (postlen - 2)] = n;
+                // same tests, in the same order, as a search through the records would do
+                for (i = from; i <= upto; i++) {
+                    if (recType(i) == 1 && prefixLength(i) + 1 == prelen && postfixLength(i) == postlen)
+                        addDecodeShape(&n, i, headerLetter(i), DECODE_HEADER_GRID);
+                    kind = decodeKindOf(i, prelen, postlen);
+                    if (kind != DECODE_NONE)
+                        break;
+                }
+                addDecodeShape(&n, (kind == DECODE_NONE ? -1 : i), 0, kind);
+            }
+        }
+    }
+}
+
+// returns how to decode a mapcode of shape prelen.postlen, starting with letter, in territory ccode
+static const decodeShapeRec *decodeShapeOf(int ccode, int prelen, int postlen, char letter)
+{
+    const decodeShapeRec *d = &decodeShapes[decodeShapeStart[ccode][(prelen - 2) * 3 + (postlen - 2)]];
+    while (d->letter != 0 && d->letter != letter)
+        d++;
+    return d;
+}
+
+// For every shape of mapcode and every first character (0..30), the territories that have a record to decode it.
+
+static TerritorySet shapeTerritories[DECODE_SHAPES][31];
+
+static void buildShapeTerritories(void)
+{
+    for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+        for (int prelen = 2; prelen <= 5; prelen++) {
+            for (int postlen = 2; postlen <= 4; postlen++) {
+                for (int c = 0; c < 31; c++) {
+                    if (decodeShapeOf(ccode, prelen, postlen, encode_chars[c])->kind != DECODE_NONE) {
+                        TerritorySet *t = &shapeTerritories[(prelen - 2) * 3 + (postlen - 2)][c];
+                        t->bits[ccode / 32] |= (1U << (ccode % 32));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// returns the territories that may decode a mapcode of shape prelen.postlen, starting with letter (or NULL if none)
+static const TerritorySet *shapeTerritoriesOf(int prelen, int postlen, char letter)
+{
+    int c = decodeChar(letter);
+    if (c < 0 || c > 30)
+        return NULL;
+    return &shapeTerritories[(prelen - 2) * 3 + (postlen - 2)][c];
+}
+
+// All derived tables are built at once, in order of dependency, by the first encode or decode on any thread (other
+// threads wait for it). After that they are only read, so encoding and decoding need no further synchronisation.
+
+#ifdef _WIN32
+static BOOL CALLBACK runOnce(PINIT_ONCE once, PVOID build, PVOID *context)
+{
+    ((void (*)(void)) build)();
+    return TRUE;
+}
+
+static void callOnce(onceFlag *once, void (*build)(void))
+{
+    InitOnceExecuteOnce(once, runOnce, (PVOID) build, NULL);
+}
+#endif
+
+static onceFlag tablesOnce = ONCE_FLAG_INIT;
+
+static void buildTables(void)
+{
+    buildBounds();
+    buildTerritoryIndex();
+    buildRedivar();
+    buildGridInfo();
+    buildNamelessInfo();
+    buildAutoHeaderInfo();
+    buildDecodeShapes();
+    buildShapeTerritories();
+}
+
+// makes sure all tables are built
+static void initTables(void)
+{
+    callOnce(&tablesOnce, buildTables);
+}
+
+// returns ch in uppercase, with digits 0 and 1 for O and I (or ch itself if not normalise)
+static char normalisedChar(char ch, int normalise)
+{
+    if (normalise) {
+        if (ch >= 'a' && ch <= 'z')
+            ch += ('A' - 'a');
+        if (ch == 'O')
+            ch = '0';
+        if (ch == 'I')
+            ch = '1';
+    }
+    return ch;
+}
+
+// returns the territory in which a proper mapcode of len characters, in territory ccode, is decoded
+static int decodeTerritoryOf(int ccode, int len)
+{
     if (len == 10) {
         // international mapcodes must be in international context
-        ccode = ccode_earth;
+        return ccode_earth;
     } else if (isSubdivision(ccode)) {
         // int mapcodes must be interpreted in the parent of a subdivision
 
         int parent = ParentTerritoryOf(ccode);
         if (len == 9 || (len == 8 && (parent == ccode_ind || parent == ccode_mex)))
-            ccode = parent;
+            return parent;
+    }
+    return ccode;
+}
+
+// returns nonzero if a mapcode of shape prelen.postlen, starting with letter, may be decoded in territory ccode
+static int isShapeOf(int ccode, int prelen, int postlen, char letter)
+{
+    const TerritorySet *t = shapeTerritoriesOf(prelen, postlen, letter);
+    return (t != NULL && ((t->bits[ccode / 32] >> (ccode % 32)) & 1));
+}
+
+// parses dec->orginput: sets dec->mapcode, dec->extension and dec->context, and the territory, record and kind of
+// decoding in cm (but not its characters); pass quickReject=1 to fail with -817, before copying and unpacking the
+// input, if the territory has no record for a well-formed mapcode (then dec holds a zero result)
+// returns nonzero if error
+static int parseMapcodeInput(decodeRec *dec, CompiledMapcode *cm, int quickReject)
+{
+    initTables();
+
+    int parentcode;
+    int ccode, len;
+
+    // determine the input, without leading and trailing whitespace (it ends at its length, or at a zero-terminator)
+    const char *r = dec->orginput;
+    size_t n = dec->orglen;
+    while (n > 0 && *r > 0 && *r <= 32) {
+        r++; // skip lead
+        n--;
+    }
+    len = (n > MAX_MAPCODE_RESULT_LEN - 1 ? MAX_MAPCODE_RESULT_LEN - 1 : (int) n);
+    const char *nul = (const char *) memchr(r, 0, len);
+    if (nul)
+        len = (int) (nul - r);
+    while (len > 0 && r[len - 1] >= 0 && r[len - 1] <= 32)
+        len--; // remove trail
+
+    // split into territory, proper mapcode and extension: in a single pass if well-formed, else the lenient way
+    mapcodeTokens tok;
+    if (tokenizeMapcode(&tok, r, (size_t) len, 1) != 0)
+        splitMapcodeInput(&tok, r, len);
+
+    parentcode = parent_of_context(dec->context); // pass for future context disambiguation
+    if (tok.parent) {
+        parentcode = disambiguate_str(tok.parent, tok.parentLength);
+        if (parentcode < 0)
+            return parentcode;
+    }
+    len = tok.mapcodeLength;
+
+    // returns nonzero if error
+    // special case for mexico country vs state
+    ccode = (tok.territory ? ccode_of_iso3(tok.territory, parentcode) : ccode_of_context(dec->context));
+    if (ccode == ccode_mex && len < 8)
+        ccode = ccode_of_iso3("5MX", -1);
+
+    // reject a well-formed mapcode (with nothing to unpack) that the territory has no record for
+    if (quickReject && tok.vowels == 0) {
+        int target = decodeTerritoryOf(ccode, len);
+        if (target >= 0 &&
+            !isShapeOf(target, tok.prefixLength, len - 1 - tok.prefixLength, normalisedChar(*tok.mapcode, 1))) {
+            dec->lat = dec->lon = 0;
+            dec->lat32 = dec->lon32 = 0;
+            dec->latNano = dec->lonNano = 0;
+            return -817;
+        }
+    }
+
+    // copy the proper mapcode and extension into a private buffer, in uppercase, with digits 0 and 1 for O and I
+    char *t = dec->minput;
+    for (const char *c = tok.mapcode; c < tok.mapcode + len; c++)
+        *t++ = normalisedChar(*c, c >= tok.normaliseFrom);
+    *t = 0;
+    dec->extension = "";
+    if (tok.extension) {
+        dec->extension = ++t;
+        for (const char *c = tok.extension; c < tok.extension + tok.extensionLength; c++)
+            *t++ = normalisedChar(*c, c >= tok.normaliseFrom);
+        *t = 0;
     }
+    char *s = dec->minput;
+
+    const char *dot = NULL; // dot position in input
+    if (tok.vowels == 0) {
+        // well-formed, and nothing to unpack
+        dot = s + tok.prefixLength;
+    } else {
+        // master_decode(s,ccode)
+        // unpack digits (a-lead or aeu-encoded
+        int voweled = unpack_if_alldigits(s);
+        if (voweled < 0)
+            return -7;
+
+        // debug support: U-lead pre-processing
+        if (*s == 'u' || *s == 'U') {
+            s++;
+            len--;
+            voweled = 1;
+        }
+
+        if (len > 10)
+            return -8;
+
+        // find dot and check that all characters are valid
+        int nrd = 0; // nr of true digits
+        for (r = s; *r != 0; r++) {
+            if (*r == '.') {
+                if (dot) {
+                    return -5; // more than one dot
+                }
+                dot = r;
+            } else if (decodeChar(*r) < 0) { // invalid char?
+                return -4;
+            } else if (decodeChar(*r) < 10) { // digit?
+                nrd++;
+            }
+        }
+        if (dot == NULL)
+            return -2;
+        else if (!voweled && nrd + 1 == len) // everything but the dot is digit, so MUST be voweled!
+            return -998;
+    }
+
+//////////// AT THIS POINT, dot=FIRST DOT, input=CLEAN INPUT (no vowels) ilen=INPUT LENGTH
+
+    // analyse input
+    int prelen = (int) (dot - s);
+    int postlen = len - 1 - prelen;
+    if (prelen < 2 || prelen > 5 || postlen < 2 || postlen > 4)
+        return -3;
+
+    ccode = decodeTerritoryOf(ccode, len);
+    if (ccode < 0)
+        return ccode; // unknown territory
 
     // remember final territory context
     dec->context = ccode;
     dec->mapcode = s;
 
-    err = -817;
+    // the record to decode s (pointing to first character of proper mapcode) with is the one for its shape
+    const decodeShapeRec *d = decodeShapeOf(ccode, prelen, postlen, *s);
+    cm->territory = (short) ccode;
+    cm->record = (short) d->rec;
+    cm->kind = d->kind;
+    return 0;
+}
+
+// decodes dec->mapcode and dec->extension in territory cm->territory, with record cm->record
+// returns nonzero if error
+static int decodeCompiled(decodeRec *dec, const CompiledMapcode *cm)
+{
+    int ccode = cm->territory;
+    int err = -817;
     int from = firstrec(ccode);
-    int upto = lastrec(ccode);
 
-    // try all ccode rectangles to decode s (pointing to first character of proper mapcode)
-    for (int i = from; i <= upto; i++) {
-        int codexi = coDex(i);
-        if (recType(i) == 0 && !isNameless(i) && (codexi == codex || (codex == 22 && codexi == 21))) {
-            err = decodeGrid(dec, i, 0);
-
-            if (isRestricted(i)) {
-                int fitssomewhere = 0;
-                int j;
-                for (j = i - 1; j >= from; j--) { // look in previous rects
-                    if (!isRestricted((j))) {
-                        if (fitsInsideWithRoom(dec->lon32, dec->lat32, j)) {
-                            fitssomewhere = 1;
-                            break;
-                        }
-                    }
-                }
-                if (!fitssomewhere) {
-                    err = -1234;
-                }
+    int i = cm->record;
+    if (cm->kind == DECODE_GRID) {
+        err = decodeGrid(dec, i, 0);
+
+        if (isRestricted(i)) {
+            // the result must also be in (or near) a previous record that is not restricted
+            const recmask *unrestricted = unrestrictedRecordsOf(ccode);
+            int fitssomewhere = 0;
+            for (int w = 0; from + w * RECMASK_BITS < i && !fitssomewhere; w++) {
+                int first = from + w * RECMASK_BITS;
+                recmask previous = (i - first >= RECMASK_BITS ? ~((recmask) 0) : (((recmask) 1) << (i - first)) - 1);
+                previous &= unrestricted[w];
+                if (previous != 0 &&
+                    containedIn(&recordBoundsWithRoom, normalisedX(dec->lon32), dec->lat32, first, previous) != 0)
+                    fitssomewhere = 1;
+            }
+            if (!fitssomewhere) {
+                err = -1234;
             }
-            break;
-        } else if (recType(i) == 1 && prefixLength(i) + 1 == prelen && postfixLength(i) == postlen &&
-                 headerLetter(i) == *s) {
-            err = decodeGrid(dec, i, 1);
-            break;
-        } else if (isNameless(i) &&
-                 ((codexi == 21 && codex == 22) ||
-                  (codexi == 22 && codex == 32) ||
-                  (codexi == 13 && codex == 23))) {
-            err = decodeNameless(dec, i);
-            break;
-        } else if (recType(i) >= 2 && postlen == 3 && prefixLength(i) + postfixLength(i) == prelen + 2) {
-            err = decodeAutoHeader(dec, i);
-            break;
         }
-    } // for
+    } else if (cm->kind == DECODE_HEADER_GRID) {
+        err = decodeGrid(dec, i, 1);
+    } else if (cm->kind == DECODE_NAMELESS) {
+        err = decodeNameless(dec, i);
+    } else if (cm->kind == DECODE_AUTO_HEADER) {
+        err = decodeAutoHeader(dec, i);
+    }
 
 #ifdef SUPPORT_HIGH_PRECISION
     // convert from millionths
     if (err) {
         dec->lat = dec->lon = 0;
+        dec->latNano = dec->lonNano = 0;
     } else {
         dec->lat /= (double) 1000000.0;
         dec->lon /= (double) 1000000.0;
@@ -1534,6 +2670,8 @@ static int decoderEngine(decodeRec *dec)
 
     dec->lat = dec->lat32 / (double)1000000.0;
     dec->lon = dec->lon32 / (double)1000000.0;
+    dec->latNano = dec->lat32 * 1000LL;
+    dec->lonNano = dec->lon32 * 1000LL;
 #endif
 
     // normalise between =180 and 180
@@ -1546,6 +2684,16 @@ static int decoderEngine(decodeRec *dec)
     if (dec->lon >= 180.0)
         dec->lon -= 360.0;
 
+    // same, in nanodegrees
+    if (dec->latNano < -90 * NANODEGREES)
+        dec->latNano = -90 * NANODEGREES;
+    if (dec->latNano > 90 * NANODEGREES)
+        dec->latNano = 90 * NANODEGREES;
+    if (dec->lonNano < -180 * NANODEGREES)
+        dec->lonNano += 360 * NANODEGREES;
+    if (dec->lonNano >= 180 * NANODEGREES)
+        dec->lonNano -= 360 * NANODEGREES;
+
     // store as integers for legacy's sake
     dec->lat32 = (int) (dec->lat * 1000000);
     dec->lon32 = (int) (dec->lon * 1000000);
@@ -1559,6 +2707,16 @@ static int decoderEngine(decodeRec *dec)
     return err;
 }
 
+// returns nonzero if error
+static int decoderEngine(decodeRec *dec)
+{
+    CompiledMapcode cm;
+    int err = parseMapcodeInput(dec, &cm, 1);
+    if (err)
+        return err;
+    return decodeCompiled(dec, &cm);
+}
+
 
 #ifdef SUPPORT_FOREIGN_ALPHABETS
 
@@ -1680,112 +2838,371 @@ static UWORD *encode_utf16(UWORD *unibuf, int maxlen, const char *mapcode,
 #endif
 
 
-#define TOKENSEP   0
-#define TOKENDOT   1
-#define TOKENCHR   2
-#define TOKENVOWEL 3
-#define TOKENZERO  4
-#define TOKENHYPH  5
+// pass fullcode=1 to recognise territory and mapcode, pass fullcode=0 to only recognise proper mapcode (without optional territory)
+// returns 0 if ok, negative in case of error (where -999 represents "may BECOME a valid mapcode if more characters are added)
+int compareWithMapcodeFormat(const char *s, int fullcode)
+{
+    mapcodeTokens tok;
+    return tokenizeMapcode(&tok, s, strlen(s), fullcode);
+}
 
 
-#define ERR -1
-#define Prt -9 // partial
-#define GO  99
 
-static signed char fullmc_statemachine[23][6] = {
-        // WHI DOT DET VOW ZER HYP
-        /* 0 start        */ {0,   ERR, 1,  1,    ERR, ERR}, // looking for very first detter
-        /* 1 gotL         */ {ERR, ERR, 2,  2,    ERR, ERR}, // got one detter, MUST get another one
-        /* 2 gotLL        */ {18,  6,   3,  3,    ERR, 14},  // GOT2: white: got territory + start prefix | dot: 2.X mapcode | det:3letter | hyphen: 2-state
-        /* 3 gotLLL       */ {18,  6,   4,   ERR, ERR, 14},  // white: got territory + start prefix | dot: 3.X mapcode | det:4letterprefix | hyphen: 3-state
-        /* 4 gotprefix4   */ {ERR, 6,   5,   ERR, ERR, ERR}, // dot: 4.X mapcode | det: got 5th prefix letter
-        /* 5 gotprefix5   */ {ERR, 6,   ERR, ERR, ERR, ERR}, // got 5char so MUST get dot!
-        /* 6 prefix.      */ {ERR, ERR, 7,  7,    Prt, ERR}, // MUST get first letter after dot
-        /* 7 prefix.L     */ {ERR, ERR, 8,  8,    Prt, ERR}, // MUST get second letter after dot
-        /* 8 prefix.LL    */ {22,  ERR, 9,  9,    GO,  11},  // get 3d letter after dot | X.2- | X.2 done!
-        /* 9 prefix.LLL   */ {22,  ERR, 10, 10,   GO,  11},  // get 4th letter after dot | X.3- | X.3 done!
-        /*10 prefix.LLLL  */ {22,  ERR, ERR, ERR, GO,  11},  // X.4- | x.4 done!
-        /*11 mc-          */ {ERR, ERR, 12,  ERR, Prt, ERR}, // MUST get first precision letter
-        /*12 mc-L         */ {22,  ERR, 13,  ERR, GO,  ERR}, // Get 2nd precision letter | done X.Y-1
-        /*13 mc-LL*       */ {22,  ERR, 13,  ERR, GO,  ERR}, // *** keep reading precision detters *** until whitespace or done
-        /*14 ctry-        */ {ERR, ERR, 15, 15,   ERR, ERR}, // MUST get first state letter
-        /*15 ctry-L       */ {ERR, ERR, 16, 16,   ERR, ERR}, // MUST get 2nd state letter
-        /*16 ctry-LL      */ {18,  ERR, 17, 17,   ERR, ERR}, // white: got CCC-SS and get prefix | got 3d letter
-        /*17 ctry-LLL     */ {18,  ERR, ERR, ERR, ERR, ERR}, // got CCC-SSS so MUST get whitespace and then get prefix
-        /*18 startprefix  */ {18,  ERR, 19, 19,   ERR, ERR}, // skip more whitespace, MUST get 1st prefix letter
-        /*19 gotprefix1   */ {ERR, ERR, 20,  ERR, ERR, ERR}, // MUST get second prefix letter
-        /*20 gotprefix2   */ {ERR, 6,   21,  ERR, ERR, ERR}, // dot: 2.X mapcode | det: 3d perfix letter
-        /*21 gotprefix3   */ {ERR, 6,   4,   ERR, ERR, ERR}, // dot: 3.x mapcode | det: got 4th prefix letter
-        /*22 whitespace   */ {22,  ERR, ERR, ERR, GO,  ERR}  // whitespace until end of string
-};
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Engine
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// returns nonzero if enc should be encoded in territory ccode
+static int isSelectedTerritory(const encodeRec *enc, int ccode)
+{
+    return (enc->territories == NULL || ((enc->territories->bits[ccode / 32] >> (ccode % 32)) & 1));
+}
 
-// pass fullcode=1 to recognise territory and mapcode, pass fullcode=0 to only recognise proper mapcode (without optional territory)
-// returns 0 if ok, negative in case of error (where -999 represents "may BECOME a valid mapcode if more characters are added)
-int compareWithMapcodeFormat(const char *s, int fullcode)
+// encodes enc for all (selected) territories
+static void encodeForAllTerritories(const encodeRec *enc, int stop_with_one_result, int extraDigits)
 {
-    int nondigits = 0, vowels = 0;
-    int state = (fullcode ? 0 : 18); // initial state
+#ifdef FAST_ENCODE
+    const int *leaf = redivarLeafOf(enc->lon32, enc->lat32);
+    int j, nr = *leaf++;
+    for (j = 0; j <= nr; j++) {
+        int ctry = (j == nr ? ccode_earth : leaf[j]);
+        if (!isSelectedTerritory(enc, ctry))
+            continue;
+        encoderEngine(ctry, enc, stop_with_one_result, extraDigits, -1, NULL);
+        if ((stop_with_one_result || debugStopAt >= 0) && enc->mapcodes->count > 0) {
+            break;
+        }
+    }
+#else
+    for (int i = 0; i < MAX_MAPCODE_TERRITORY_CODE; i++) {
+        if (!isSelectedTerritory(enc, i))
+            continue;
+        encoderEngine(i, enc, stop_with_one_result, extraDigits, -1, NULL);
+        if ((stop_with_one_result || debugStopAt >= 0) && enc->mapcodes->count > 0)
+            break;
+    }
+#endif
+}
 
-    for (; ; s++) {
-        int newstate, token;
-        // recognise token: decode returns -2=a -3=e -4=0, 0..9 for digit or "o" or "i", 10..31 for char, -1 for illegal char
-        if (*s == '.') {
-            token = TOKENDOT;
-        } else if (*s == '-') {
-            token = TOKENHYPH;
-        } else if (*s == 0) {
-            token = TOKENZERO;
-        } else if (*s == ' ' || *s == '\t') {
-            token = TOKENSEP;
-        } else {
-            signed char c = decode_chars[(unsigned char) *s];
-            if (c < 0) { // vowel or illegal?
-                token = TOKENVOWEL;
-                vowels++; // assume vowel (-2,-3,-4)
-                if (c == -1) { // illegal?
-                    return -4;
-                }
-            } else if (c < 10) { // digit
-                token = TOKENCHR; // digit
-            } else { // charcter B-Z
-                token = TOKENCHR;
-                if (state != 11 && state != 12 && state != 13) {
-                    nondigits++;
-                }
-            }
+#ifdef WORLD_INDEX_CELL_SIZE
+
+// encodes enc for all (selected) territories, using the world index; returns 0 if the world index is not available
+static int encodeWithWorldIndex(const encodeRec *enc, int stop_with_one_result, int extraDigits)
+{
+    callOnce(&worldIndexOnce, buildWorldIndex);
+    if (worldIndexReady < 0)
+        return 0;
+
+    int cell = ((enc->lat32 + 90000000) / WORLD_INDEX_CELL_SIZE) * WORLD_INDEX_COLUMNS +
+               ((enc->lon32 + 180000000) / WORLD_INDEX_CELL_SIZE);
+    const unsigned short *r = worldCellRecords + worldCellStart[cell];
+    const unsigned short *e = worldCellRecords + worldCellStart[cell + 1];
+
+    while (r < e) { // records are grouped per territory, in order
+        recmask candidates[MAX_RECMASK_WORDS];
+        int ccode = recordTerritory[*r];
+        int from = firstrec(ccode);
+        int upto = lastrec(ccode);
+
+        if (!isSelectedTerritory(enc, ccode)) {
+            while (r < e && *r <= upto)
+                r++;
+            continue;
         }
-        newstate = fullmc_statemachine[state][token];
-        if (newstate == ERR) {
-            return -(1000 + 10 * state + token);
-        } else if (newstate == GO) {
-            return (nondigits ? (vowels > 0 ? -6 : 0) : (vowels > 0 && vowels <= 2 ? 0 : -5));
-        } else if (newstate == Prt) {
-            return -999;
-        } else if (newstate == 18) {
-            nondigits = vowels = 0;
+
+        memset(candidates, 0, sizeof(candidates));
+        for (; r < e && *r <= upto; r++)
+            candidates[(*r - from) / RECMASK_BITS] |= ((recmask) 1) << ((*r - from) % RECMASK_BITS);
+
+        encoderEngine(ccode, enc, stop_with_one_result, extraDigits, -1, candidates);
+        if ((stop_with_one_result || debugStopAt >= 0) && enc->mapcodes->count > 0)
+            break;
+    }
+    return 1;
+}
+
+#endif // WORLD_INDEX_CELL_SIZE
+
+#ifdef FAST_ENCODE
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Trajectories
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// narrows area (minx, miny, maxx, maxy) around x,y to a part that is either inside or outside the given rectangle
+static void clipToRectangle(int *area, int x, int y, int minx, int miny, int maxx, int maxy)
+{
+    if (minx >= maxx || maxx <= area[0] || minx >= area[2] || maxy <= area[1] || miny >= area[3])
+        return; // empty, or outside area
+
+    if (minx <= x && x < maxx && miny <= y && y < maxy) { // inside: keep the part inside the rectangle
+        if (area[0] < minx)
+            area[0] = minx;
+        if (area[1] < miny)
+            area[1] = miny;
+        if (area[2] > maxx)
+            area[2] = maxx;
+        if (area[3] > maxy)
+            area[3] = maxy;
+        return;
+    }
+
+    // outside: cut the rectangle off along the side that is furthest from x,y
+    int side = -1, distance = -1;
+    if (x < minx && minx - x > distance) {
+        side = 2;
+        distance = minx - x;
+    }
+    if (x >= maxx && x - maxx > distance) {
+        side = 0;
+        distance = x - maxx;
+    }
+    if (y < miny && miny - y > distance) {
+        side = 3;
+        distance = miny - y;
+    }
+    if (y >= maxy && y - maxy > distance) {
+        side = 1;
+    }
+    area[side] = (side == 0 ? maxx : side == 1 ? maxy : side == 2 ? minx : miny);
+}
+
+// narrows area around x,y to a part that is inside or outside each record of territory ccode
+static void clipToTerritory(int *area, int x, int y, int ccode)
+{
+    const boundsArrays *a = &recordBounds;
+    for (int m = firstrec(ccode); m <= lastrec(ccode); m++) {
+        clipToRectangle(area, x, y, a->minx[m], a->miny[m], a->maxx[m], a->maxy[m]);
+        clipToRectangle(area, x, y, a->minx2[m], a->miny[m], a->maxx2[m], a->maxy[m]);
+    }
+}
+
+// sets the area of trajectory to a part around x,y where all points are in the same records as x,y
+static void setTrajectoryArea(TrajectoryEncoder *trajectory, int x, int y)
+{
+    int area[4] = {-180000000, -90000000, 180000001, 90000001};
+
+
+    // the territories to try, and their records, must stay the same
+    redivarArea(x, y, area);
+    const int *leaf = redivarLeafOf(x, y);
+    int j, nr = *leaf++;
+    for (j = 0; j <= nr; j++) {
+        int ctry = (j == nr ? ccode_earth : leaf[j]);
+        clipToTerritory(area, x, y, ctry);
+        if (territoryIndex[ctry].parent >= 0)
+            clipToTerritory(area, x, y, territoryIndex[ctry].parent);
+    }
+
+    trajectory->minx = area[0];
+    trajectory->miny = area[1];
+    trajectory->maxx = area[2];
+    trajectory->maxy = area[3];
+}
+
+// encodes enc in the records of trajectory, as found for an earlier point in the same area
+static void encodeInTrajectoryRecords(const TrajectoryEncoder *trajectory, const encodeRec *enc)
+{
+    char result[128];
+    int result_counter = 0;
+    for (int k = 0; k < trajectory->count; k++) {
+        int ccode = trajectory->territory[k];
+        int result_override = trajectory->override[k];
+        if (k > 0 && (ccode != trajectory->territory[k - 1] || result_override != trajectory->override[k - 1]))
+            result_counter = 0; // next territory
+
+        *result = 0;
+        encodeInRecord(result, enc, trajectory->record[k], trajectory->extraDigits, result_counter);
+        if (*result) {
+            result_counter++;
+            repack_if_alldigits(result, 0);
+            addResult(enc, result, (result_override >= 0 ? result_override : ccode));
         }
-        state = newstate;
     }
 }
 
+#endif // FAST_ENCODE
 
+// encodes enc in territory tc (or, if tc <= 0, for all territories)
+static void encodeInTerritory(const encodeRec *enc, int tc, int stop_with_one_result, int extraDigits)
+{
+    if (tc <= 0) { // ALL results?
+#ifdef WORLD_INDEX_CELL_SIZE
+        if (!encodeWithWorldIndex(enc, stop_with_one_result, extraDigits))
+#endif
+            encodeForAllTerritories(enc, stop_with_one_result, extraDigits);
+    } else {
+        encoderEngine((tc - 1), enc, stop_with_one_result, extraDigits, -1, NULL);
+    }
+}
+
+#ifdef SUPPORT_ENCODE_CACHE
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
-//  Engine
+//  Encode cache
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// pass point to an array of pointers (at least 42), will be made to point to result strings...
-// returns nr of results;
-static int encodeLatLonToMapcodes_internal(char **v, Mapcodes *mapcodes, double lat, double lon, int tc,
-                                           int stop_with_one_result,
-                                           int extraDigits) // 1.31 allow to stop after one result
+// The cache is split into shards, each with its own lock, hash table and least-recently-used list (of entry indices).
+
+#define ENCODE_CACHE_SHARDS 16
+
+typedef struct {
+    int lat32, lon32;
+    double fraclat, fraclon;
+    int territoryCode, extraDigits, precise;
+    unsigned int hash;
+    int next;                       // next entry in the same bucket, or -1
+    int newer, older;               // neighbours in the least-recently-used list, or -1
+    Mapcodes mapcodes;
+} cacheEntry;
+
+typedef struct {
+    cacheLock lock;
+    int capacity;                   // number of entries (0 if the cache is disabled)
+    int used;
+    int newest, oldest;             // ends of the least-recently-used list, or -1
+    int *buckets;                   // first entry of each bucket (there are capacity buckets), or -1
+    cacheEntry *entries;
+    long hits, misses;
+} cacheShard;
+
+static int cacheLocksReady;
+static cacheShard cacheShards[ENCODE_CACHE_SHARDS];
+
+static unsigned int cacheHash(const encodeRec *enc, int tc, int extraDigits)
 {
-    encodeRec enc;
-    enc.mapcodes = mapcodes;
-    enc.mapcodes->count = 0;
+    unsigned long long f[2];
+    memcpy(&f[0], &enc->fraclat, sizeof(f[0]));
+    memcpy(&f[1], &enc->fraclon, sizeof(f[1]));
+    unsigned long long h = (unsigned int) enc->lat32;
+    h = h * 0x9E3779B97F4A7C15ULL + (unsigned int) enc->lon32;
+    h = h * 0x9E3779B97F4A7C15ULL + f[0];
+    h = h * 0x9E3779B97F4A7C15ULL + f[1];
+    h = h * 0x9E3779B97F4A7C15ULL + (unsigned int) ((tc * 16 + extraDigits) * 2 + enc->precise);
+    return (unsigned int) (h >> 32);
+}
+
+static int isCacheEntryFor(const cacheEntry *e, const encodeRec *enc, int tc, int extraDigits)
+{
+    return (e->lat32 == enc->lat32 && e->lon32 == enc->lon32 && e->fraclat == enc->fraclat &&
+            e->fraclon == enc->fraclon && e->territoryCode == tc && e->extraDigits == extraDigits &&
+            e->precise == enc->precise);
+}
+
+// removes entry i from the least-recently-used list of shard c
+static void unlinkCacheEntry(cacheShard *c, int i)
+{
+    cacheEntry *e = &c->entries[i];
+    if (e->newer >= 0)
+        c->entries[e->newer].older = e->older;
+    else
+        c->newest = e->older;
+    if (e->older >= 0)
+        c->entries[e->older].newer = e->newer;
+    else
+        c->oldest = e->newer;
+}
+
+// makes entry i the newest of shard c
+static void linkCacheEntry(cacheShard *c, int i)
+{
+    cacheEntry *e = &c->entries[i];
+    e->newer = -1;
+    e->older = c->newest;
+    if (c->newest >= 0)
+        c->entries[c->newest].newer = i;
+    else
+        c->oldest = i;
+    c->newest = i;
+}
+
+// returns the entry for enc in shard c (with the given hash), or -1; the shard must be locked
+static int findCacheEntry(const cacheShard *c, unsigned int hash, const encodeRec *enc, int tc, int extraDigits)
+{
+    int i = c->buckets[hash % (unsigned int) c->capacity];
+    while (i >= 0 && !isCacheEntryFor(&c->entries[i], enc, tc, extraDigits))
+        i = c->entries[i].next;
+    return i;
+}
+
+static void copyMapcodes(Mapcodes *to, const Mapcodes *from)
+{
+    to->count = from->count;
+    memcpy(to->mapcode, from->mapcode, from->count * sizeof(from->mapcode[0]));
+}
+
+// encodes enc in territory tc (or, if tc <= 0, for all territories), using the cache
+static void encodeWithCache(const encodeRec *enc, int tc, int extraDigits)
+{
+    if (tc < 0)
+        tc = 0;
+    unsigned int hash = cacheHash(enc, tc, extraDigits);
+    cacheShard *c = &cacheShards[hash % ENCODE_CACHE_SHARDS];
+    hash /= ENCODE_CACHE_SHARDS;
+
+    // the capacity does not change while encoding, so a disabled cache is skipped without locking
+    if (!cacheLocksReady || c->capacity == 0) {
+        encodeInTerritory(enc, tc, 0, extraDigits);
+        return;
+    }
+
+    // a hit moves the entry to the front of the least-recently-used list, so lookups lock the shard exclusively
+    lockCache(&c->lock);
+    int i = findCacheEntry(c, hash, enc, tc, extraDigits);
+    if (i >= 0) {
+        c->hits++;
+        unlinkCacheEntry(c, i);
+        linkCacheEntry(c, i);
+        copyMapcodes(enc->mapcodes, &c->entries[i].mapcodes);
+        unlockCache(&c->lock);
+        return;
+    }
+    c->misses++;
+    unlockCache(&c->lock);
+
+    encodeInTerritory(enc, tc, 0, extraDigits);
+
+    lockCache(&c->lock);
+    if (findCacheEntry(c, hash, enc, tc, extraDigits) < 0) { // not added by another thread?
+        if (c->used < c->capacity) {
+            i = c->used++;
+        } else { // re-use the least recently used entry
+            i = c->oldest;
+            unlinkCacheEntry(c, i);
+            int *p = &c->buckets[c->entries[i].hash % (unsigned int) c->capacity];
+            while (*p != i)
+                p = &c->entries[*p].next;
+            *p = c->entries[i].next;
+        }
+        cacheEntry *e = &c->entries[i];
+        e->lat32 = enc->lat32;
+        e->lon32 = enc->lon32;
+        e->fraclat = enc->fraclat;
+        e->fraclon = enc->fraclon;
+        e->territoryCode = tc;
+        e->extraDigits = extraDigits;
+        e->precise = enc->precise;
+        e->hash = hash;
+        copyMapcodes(&e->mapcodes, enc->mapcodes);
+        e->next = c->buckets[hash % (unsigned int) c->capacity];
+        c->buckets[hash % (unsigned int) c->capacity] = i;
+        linkCacheEntry(c, i);
+    }
+    unlockCache(&c->lock);
+}
+
+#endif // SUPPORT_ENCODE_CACHE
+
+// sets the (normalised) coordinate of enc to lat,lon; if precise, fractions of microdegrees are taken into account
+static void setEncodeCoordinate(encodeRec *enc, double lat, double lon, int extraDigits, int precise)
+{
+    initTables();
 
     if (lat < -90)
         lat = -90;
@@ -1796,93 +3213,93 @@ static int encodeLatLonToMapcodes_internal(char **v, Mapcodes *mapcodes, double
     while (lon >= 180)
         lon -= 360;
 
-#ifndef SUPPORT_HIGH_PRECISION
-    lat *= 1000000;
-    if (lat < 0)
-        lat -= 0.5;
-    else
-        lat += 0.5;
-    lon *= 1000000;
-    if (lon<0)
-        lon-=0.5;
-    else
-        lon+=0.5;
-    enc.lat32 = (int)lat;
-    enc.lon32 = (int)lon;
-#else // precise encoding: do NOT round, instead remember the fraction...
+    if (!precise) { // microdegree encoding: round to the nearest microdegree
+        lat *= 1000000;
+        if (lat < 0)
+            lat -= 0.5;
+        else
+            lat += 0.5;
+        lon *= 1000000;
+        if (lon < 0)
+            lon -= 0.5;
+        else
+            lon += 0.5;
+        enc->lat32 = (int) lat;
+        enc->lon32 = (int) lon;
+        enc->fraclat = enc->fraclon = 0;
+        enc->fixedlat = enc->fixedlon = 0;
+        enc->precise = 0;
+        return;
+    }
+
+    // precise encoding: do NOT round, instead remember the fraction...
     lat += 90;
     lon += 180;
     lat *= 1000000;
     lon *= 1000000;
-    enc.lat32 = (int) lat;
-    enc.lon32 = (int) lon;
-    enc.fraclat = lat - enc.lat32;
-    enc.fraclon = lon - enc.lon32;
+    enc->lat32 = (int) lat;
+    enc->lon32 = (int) lon;
+    enc->fraclat = lat - enc->lat32;
+    enc->fraclon = lon - enc->lon32;
     // for 8-digit precision, cells are divided into 810,000 by 810,000 minicells.
-    enc.fraclat *= 810000;
-    if (enc.fraclat < 1) {
-        enc.fraclat = 0;
+    enc->fraclat *= 810000;
+    if (enc->fraclat < 1) {
+        enc->fraclat = 0;
     } else {
-        if (enc.fraclat > 809999) {
-            enc.fraclat = 0;
-            enc.lat32++;
+        if (enc->fraclat > 809999) {
+            enc->fraclat = 0;
+            enc->lat32++;
         } else {
-            enc.fraclat /= 810000;
+            enc->fraclat /= 810000;
         }
     }
-    enc.fraclon *= 810000;
-    if (enc.fraclon < 1) {
-        enc.fraclon = 0;
+    enc->fraclon *= 810000;
+    if (enc->fraclon < 1) {
+        enc->fraclon = 0;
     } else {
-        if (enc.fraclon > 809999) {
-            enc.fraclon = 0;
-            enc.lon32++;
+        if (enc->fraclon > 809999) {
+            enc->fraclon = 0;
+            enc->lon32++;
         } else {
-            enc.fraclon /= 810000;
+            enc->fraclon /= 810000;
         }
     }
-    enc.lat32 -= 90000000;
-    enc.lon32 %= 360000000;
-    enc.lon32 -= 180000000;
-#endif
+    enc->fixedlat = (long long) (enc->fraclat * FRACTION_ONE);
+    enc->fixedlon = (long long) (enc->fraclon * FRACTION_ONE);
+    enc->lat32 -= 90000000;
+    enc->lon32 %= 360000000;
+    enc->lon32 -= 180000000;
+
+    // without extension and fractions, the cheaper microdegree encoding gives identical results
+    enc->precise = (extraDigits > 0 || enc->fixedlat > 0 || enc->fixedlon > 0);
+}
 
-    if (tc <= 0) { // ALL results?
-#ifdef FAST_ENCODE
-        int HOR = 1;
-        int i = 0; // pointer into redivar
-        for (; ;) {
-            int v2 = redivar[i++];
-            HOR = 1 - HOR;
-            if (v2 >= 0 && v2 < 1024) { // leaf?
-                int j, nr = v2;
-                for (j = 0; j <= nr; j++) {
-                    int ctry = (j == nr ? ccode_earth : redivar[i + j]);
-                    encoderEngine(ctry, &enc, stop_with_one_result, extraDigits, -1);
-                    if ((stop_with_one_result || debugStopAt >= 0) && enc.mapcodes->count > 0) {
-                        break;
-                    }
-                }
-                break;
-            }
-            else {
-                int coord = (HOR ? enc.lon32 : enc.lat32);
-                if (coord > v2) {
-                    i = redivar[i];
-                }
-                else {
-                    i++;
-                }
-            }
-        }
-#else
-        for(int i = 0; i < MAX_MAPCODE_TERRITORY_CODE ; i++) {
-          encoderEngine(i, &enc, stop_with_one_result, extraDigits, -1);
-          if ((stop_with_one_result || debugStopAt >= 0) && enc.mapcodes->count > 0)
-            break;
-        }
+// pass point to an array of pointers (at least 42), will be made to point to result strings...
+// returns nr of results;
+// if add_international, the international mapcode is added after the results (unless it is already there)
+static int encodeLatLonToMapcodes_internal(char **v, Mapcodes *mapcodes, double lat, double lon, int tc,
+                                           int stop_with_one_result,
+                                           int extraDigits, // 1.31 allow to stop after one result
+                                           int add_international, int precise)
+{
+    encodeRec enc;
+    enc.mapcodes = mapcodes;
+    enc.mapcodes->count = 0;
+    enc.territories = NULL;
+    enc.trajectory = NULL;
+    setEncodeCoordinate(&enc, lat, lon, extraDigits, precise);
+
+#ifdef SUPPORT_ENCODE_CACHE
+    if (!stop_with_one_result && !add_international && debugStopAt < 0)
+        encodeWithCache(&enc, tc, extraDigits);
+    else
 #endif
-    } else {
-        encoderEngine((tc - 1), &enc, stop_with_one_result, extraDigits, -1);
+        encodeInTerritory(&enc, tc, stop_with_one_result, extraDigits);
+
+    if (add_international) {
+        int count = enc.mapcodes->count;
+        if (count == 0 || strchr(enc.mapcodes->mapcode[count - 1], ' ') != NULL) // no international result yet?
+            encoderEngine(ccode_earth, &enc, 1, extraDigits, -1, NULL);
     }
 
     if (v) {
@@ -1983,12 +3400,19 @@ int convertTerritoryIsoNameToCode(const char *string, int optional_tc) // option
 // decode string into lat,lon; returns negative in case of error
 // context_tc is used to disambiguate ambiguous short mapcode inputs; pass 0 or negative if not available
 int decodeMapcodeToLatLon(double *lat, double *lon, const char *input,  int context_tc)
+{
+    return decodeMapcodeToLatLonWithLength(lat, lon, input, (input ? strlen(input) : 0), context_tc);
+}
+
+// decode the input of (at most) length characters into lat,lon, without copying it; the input need not be zero-terminated
+int decodeMapcodeToLatLonWithLength(double *lat, double *lon, const char *input, size_t length, int context_tc)
 {
     if (lat == NULL || lon == NULL || input == NULL) {
         return -100;
     } else {
         decodeRec dec;
         dec.orginput = input;
+        dec.orglen = length;
         dec.context = context_tc;
 
         int ret = decoderEngine(&dec);
@@ -1998,6 +3422,123 @@ int decodeMapcodeToLatLon(double *lat, double *lon, const char *input,  int cont
     }
 }
 
+// decode string into lat,lon in nanodegrees (computed in integer arithmetic); returns negative in case of error
+int decodeMapcodeToNanodegrees(long long *lat, long long *lon, const char *input, int context_tc)
+{
+    if (lat == NULL || lon == NULL || input == NULL) {
+        return -100;
+    } else {
+        decodeRec dec;
+        dec.orginput = input;
+        dec.orglen = strlen(input);
+        dec.context = context_tc;
+
+        int ret = decoderEngine(&dec);
+        *lat = dec.latNano;
+        *lon = dec.lonNano;
+        return ret;
+    }
+}
+
+// parse a mapcode string once into compiled, for repeated decoding with decodeCompiledMapcode; returns negative in case of error
+int compileMapcode(CompiledMapcode *compiled, const char *input, int context_tc)
+{
+    if (compiled == NULL || input == NULL) {
+        return -100;
+    } else {
+        decodeRec dec;
+        dec.orginput = input;
+        dec.orglen = strlen(input);
+        dec.context = context_tc;
+
+        int ret = parseMapcodeInput(&dec, compiled, 1);
+        if (ret)
+            return ret;
+        if (compiled->kind == DECODE_NONE)
+            return -817; // no record decodes it
+        if (strlen(dec.extension) > MAX_PRECISION_DIGITS)
+            return -10; // extension does not fit (decodeMapcodeToLatLon accepts it)
+        strcpy(compiled->mapcode, dec.mapcode);
+        strcpy(compiled->extension, dec.extension);
+        return 0;
+    }
+}
+
+// decode a mapcode (without territory) in every territory it is valid in; returns the number of results, or negative
+// in case of error
+int decodeMapcodeInAllTerritories(TerritoryResults *results, const char *input)
+{
+    if (results == NULL || input == NULL)
+        return -100;
+    results->count = 0;
+
+    decodeRec dec;
+    CompiledMapcode cm;
+    dec.orginput = input;
+    dec.orglen = strlen(input);
+    dec.context = ccode_earth + 1;
+    int ret = parseMapcodeInput(&dec, &cm, 0);
+    if (ret)
+        return ret;
+
+    // a mapcode with a territory, or an international mapcode, only decodes in its own territory
+    const char *dot = strchr(dec.mapcode, '.');
+    int prelen = (int) (dot - dec.mapcode);
+    int postlen = (int) strlen(dot + 1);
+    int len = prelen + 1 + postlen;
+    TerritorySet targets;
+    memset(&targets, 0, sizeof(targets));
+    if (cm.territory != ccode_earth || len == 10) {
+        targets.bits[cm.territory / 32] |= 1u << (cm.territory % 32);
+    } else {
+        // without a territory, a local mapcode decodes in the territory each context redirects it to (one result each)
+        int mexicanState = ccode_of_iso3("5MX", -1);
+        for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+            int target = decodeTerritoryOf((ccode == ccode_mex && len < 8) ? mexicanState : ccode, len);
+            if (target >= 0 && isShapeOf(target, prelen, postlen, *dec.mapcode))
+                targets.bits[target / 32] |= 1u << (target % 32);
+        }
+    }
+
+    for (int ccode = 0; ccode < MAX_CCODE; ccode++) {
+        if (!((targets.bits[ccode / 32] >> (ccode % 32)) & 1))
+            continue;
+        const decodeShapeRec *d = decodeShapeOf(ccode, prelen, postlen, *dec.mapcode);
+        if (d->kind == DECODE_NONE)
+            continue;
+        cm.territory = (short) ccode;
+        cm.record = (short) d->rec;
+        cm.kind = d->kind;
+        dec.context = ccode;
+        if (decodeCompiled(&dec, &cm) == 0) {
+            results->territoryCode[results->count] = ccode + 1;
+            results->lat[results->count] = dec.lat;
+            results->lon[results->count] = dec.lon;
+            results->count++;
+        }
+    }
+    return results->count;
+}
+
+// decode a compiled mapcode into lat,lon; returns negative in case of error
+int decodeCompiledMapcode(double *lat, double *lon, const CompiledMapcode *compiled)
+{
+    if (lat == NULL || lon == NULL || compiled == NULL) {
+        return -100;
+    } else {
+        decodeRec dec;
+        initTables();
+        dec.mapcode = compiled->mapcode;
+        dec.extension = compiled->extension;
+        dec.context = compiled->territory;
+
+        int ret = decodeCompiled(&dec, compiled);
+        *lat = dec.lat;
+        *lon = dec.lon;
+        return ret;
+    }
+}
+
 #ifdef SUPPORT_FOREIGN_ALPHABETS
 
 UWORD *convertToAlphabet(UWORD *unibuf, int maxlength, const char *mapcode, int alphabet) // 0=roman, 2=cyrillic
@@ -2045,7 +3586,7 @@ int encodeLatLonToSingleMapcode(char *result, double lat, double lon, int tc, in
 {
     char *v[2];
     Mapcodes rlocal;
-    int ret = encodeLatLonToMapcodes_internal(v, &rlocal, lat, lon, tc, 1, extraDigits);
+    int ret = encodeLatLonToMapcodes_internal(v, &rlocal, lat, lon, tc, 1, extraDigits, 0, PRECISE_BY_DEFAULT);
     *result = 0;
     if (ret <= 0) { // no solutions?
         return -1;
@@ -2059,10 +3600,193 @@ int encodeLatLonToSingleMapcode(char *result, double lat, double lon, int tc, in
     return 1;
 }
 
+// Threadsafe
+int encodeLatLonToInternationalMapcode(char *result, double lat, double lon, int extraDigits)
+{
+    encodeRec enc;
+    enc.mapcodes = NULL;
+    enc.territories = NULL;
+    enc.trajectory = NULL;
+    setEncodeCoordinate(&enc, lat, lon, extraDigits, PRECISE_BY_DEFAULT);
+
+    int m = earthRecordOf(enc.lat32);
+    *result = 0;
+    if (fitsInside(enc.lon32, enc.lat32, m)) {
+        encodeGrid(result, &enc, m, extraDigits, headerLetter(m));
+        repack_if_alldigits(result, 0);
+    }
+    return (*result ? 1 : 0);
+}
+
+// Threadsafe
+int encodeLatLonToShortestMapcodes(Mapcodes *results, double lat, double lon, int territoryCode, int extraDigits)
+{
+    return encodeLatLonToMapcodes_internal(NULL, results, lat, lon, territoryCode, 1, extraDigits, 1, PRECISE_BY_DEFAULT);
+}
+
 // Threadsafe
 int encodeLatLonToMapcodes(Mapcodes *results, double lat, double lon, int territoryCode, int extraDigits)
 {
-    return encodeLatLonToMapcodes_internal(NULL, results, lat, lon, territoryCode, 0, extraDigits);
+    return encodeLatLonToMapcodes_internal(NULL, results, lat, lon, territoryCode, 0, extraDigits, 0,
+                                           PRECISE_BY_DEFAULT);
+}
+
+// Threadsafe
+int encodeLatLonToMicrodegreeMapcodes(Mapcodes *results, double lat, double lon, int territoryCode, int extraDigits)
+{
+    return encodeLatLonToMapcodes_internal(NULL, results, lat, lon, territoryCode, 0, extraDigits, 0, 0);
+}
+
+// Threadsafe
+int encodeLatLonToMapcodesInTerritories(Mapcodes *results, double lat, double lon, const TerritorySet *territories,
+                                        int extraDigits)
+{
+    encodeRec enc;
+    enc.mapcodes = results;
+    enc.mapcodes->count = 0;
+    enc.territories = territories;
+    enc.trajectory = NULL;
+    setEncodeCoordinate(&enc, lat, lon, extraDigits, PRECISE_BY_DEFAULT);
+
+#ifdef WORLD_INDEX_CELL_SIZE
+    if (!encodeWithWorldIndex(&enc, 0, extraDigits))
+#endif
+        encodeForAllTerritories(&enc, 0, extraDigits);
+    return enc.mapcodes->count;
+}
+
+#ifdef SUPPORT_ENCODE_CACHE
+
+// NOT threadsafe: must not be called while encoding
+int setEncodeCacheCapacity(int capacity)
+{
+    int ok = 1;
+    if (!cacheLocksReady) {
+        for (int i = 0; i < ENCODE_CACHE_SHARDS; i++)
+            initCacheLock(&cacheShards[i].lock);
+        cacheLocksReady = 1;
+    }
+    for (int i = 0; i < ENCODE_CACHE_SHARDS; i++) {
+        cacheShard *c = &cacheShards[i];
+        int n = (capacity + ENCODE_CACHE_SHARDS - 1) / ENCODE_CACHE_SHARDS;
+        free(c->buckets);
+        free(c->entries);
+        c->buckets = NULL;
+        c->entries = NULL;
+        c->capacity = c->used = 0;
+        c->newest = c->oldest = -1;
+        if (n > 0) {
+            c->buckets = (int *) malloc(n * sizeof(int));
+            c->entries = (cacheEntry *) malloc(n * sizeof(cacheEntry));
+            if (c->buckets == NULL || c->entries == NULL) {
+                free(c->buckets);
+                free(c->entries);
+                c->buckets = NULL;
+                c->entries = NULL;
+                ok = 0;
+                continue;
+            }
+            for (int b = 0; b < n; b++)
+                c->buckets[b] = -1;
+            c->capacity = n;
+        }
+    }
+    return ok;
+}
+
+// Threadsafe
+void getEncodeCacheStatistics(long *hits, long *misses)
+{
+    *hits = *misses = 0;
+    if (!cacheLocksReady)
+        return;
+    for (int i = 0; i < ENCODE_CACHE_SHARDS; i++) {
+        cacheShard *c = &cacheShards[i];
+        lockCache(&c->lock);
+        *hits += c->hits;
+        *misses += c->misses;
+        unlockCache(&c->lock);
+    }
+}
+
+#else // no encode cache
+
+int setEncodeCacheCapacity(int capacity)
+{
+    return (capacity == 0);
+}
+
+void getEncodeCacheStatistics(long *hits, long *misses)
+{
+    *hits = *misses = 0;
+}
+
+#endif // SUPPORT_ENCODE_CACHE
+
+// Threadsafe (for different trajectories)
+void initTrajectoryEncoder(TrajectoryEncoder *trajectory, int extraDigits)
+{
+    trajectory->extraDigits = extraDigits;
+    trajectory->count = -1;
+}
+
+// Threadsafe (for different trajectories)
+int encodeTrajectoryPoint(TrajectoryEncoder *trajectory, Mapcodes *results, double lat, double lon)
+{
+    encodeRec enc;
+    enc.mapcodes = results;
+    enc.mapcodes->count = 0;
+    enc.territories = NULL;
+    enc.trajectory = NULL;
+    setEncodeCoordinate(&enc, lat, lon, trajectory->extraDigits, PRECISE_BY_DEFAULT);
+
+#ifdef FAST_ENCODE
+    int x = enc.lon32;
+    int y = enc.lat32;
+    if (trajectory->count >= 0 && debugStopAt < 0 &&
+        trajectory->minx <= x && x < trajectory->maxx && trajectory->miny <= y && y < trajectory->maxy) {
+        encodeInTrajectoryRecords(trajectory, &enc);
+        return enc.mapcodes->count;
+    }
+
+    // full search, remembering the records that contain x,y
+    trajectory->count = 0;
+    enc.trajectory = trajectory;
+    encodeForAllTerritories(&enc, 0, trajectory->extraDigits);
+    if (trajectory->count >= 0)
+        setTrajectoryArea(trajectory, x, y);
+#else
+    encodeForAllTerritories(&enc, 0, trajectory->extraDigits);
+#endif
+    return enc.mapcodes->count;
+}
+
+// Threadsafe
+void addToTerritorySet(TerritorySet *territories, int territoryCode)
+{
+    if (territoryCode >= 1 && territoryCode <= MAX_MAPCODE_TERRITORY_CODE)
+        territories->bits[(territoryCode - 1) / 32] |= (1U << ((territoryCode - 1) % 32));
+}
+
+// Threadsafe
+int encodeLatLonToPreciseMapcodes(Mapcodes *results, double lat, double lon, int territoryCode)
+{
+    return encodeLatLonToMapcodes_internal(NULL, results, lat, lon, territoryCode, 0, MAX_PRECISION_DIGITS, 0, 1);
+}
+
+// Threadsafe
+char *getMapcodeWithPrecision(char *result, const char *mapcode, int extraDigits)
+{
+    const char *s = strrchr(mapcode, ' '); // skip territory (which may contain a hyphen)
+    const char *minus = strchr(s ? s : mapcode, '-');
+    int len = (minus ? (int) (minus - mapcode) : (int) strlen(mapcode));
+    if (minus && extraDigits > 0) {
+        int available = (int) strlen(minus + 1);
+        len += 1 + (extraDigits < available ? extraDigits : available);
+    }
+    memcpy(result, mapcode, len);
+    result[len] = 0;
+    return result;
 }
 
 // Legacy: NOT threadsafe
@@ -2070,7 +3794,8 @@ Mapcodes rglobal;
 
 int encodeLatLonToMapcodes_Deprecated(char **v, double lat, double lon, int territoryCode, int extraDigits)
 {
-    return encodeLatLonToMapcodes_internal(v, &rglobal, lat, lon, territoryCode, 0, extraDigits);
+    return encodeLatLonToMapcodes_internal(v, &rglobal, lat, lon, territoryCode, 0, extraDigits, 0,
+                                           PRECISE_BY_DEFAULT);
 }
 
 // Legacy: NOT threadsafe
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <stddef.h> // size_t
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,7 +25,9 @@ extern "C" {
 #define UWORD                               unsigned short int  // 2-byte unsigned integer.
 
 #define SUPPORT_FOREIGN_ALPHABETS           // Define to support additional alphabets.
-#define SUPPORT_HIGH_PRECISION              // Define to enable high-precision extension logic.
+#define SUPPORT_HIGH_PRECISION              // Define to enable high-precision extension logic (by default, see encodeLatLonToMicrodegreeMapcodes).
+// #define SUPPORT_ENCODE_CACHE                // Define to enable a thread-safe cache of encode results (see setEncodeCacheCapacity).
+// #define WORLD_INDEX_CELL_SIZE            250000      // Define to speed up encoding for all territories with a world-wide index, using cells of this many microdegrees (250000 uses about 10 MB, 1000000 less than 1 MB).
 
 #define MAX_NR_OF_MAPCODE_RESULTS           21          // Max. number of results ever returned by encoder (e.g. for 26.904899, 95.138515).
 #define MAX_PROPER_MAPCODE_LEN              10          // Max. number of characters in a proper mapcode (including the dot).
@@ -42,6 +46,57 @@ typedef struct {
     char mapcode[MAX_NR_OF_MAPCODE_RESULTS][MAX_MAPCODE_RESULT_LEN];  // The mapcodes.
 } Mapcodes;
 
+/**
+ * The type TerritorySet holds a set of territories, to restrict encoding to. A zero-initialised TerritorySet
+ * is empty; use addToTerritorySet to add territories to it.
+ */
+#define TERRITORY_SET_WORDS                 17          // Number of 32-bit words in a TerritorySet (at least one bit per territory code).
+
+typedef struct {
+    unsigned int bits[TERRITORY_SET_WORDS];                           // Bit (territoryCode - 1) is set for included territories.
+} TerritorySet;
+
+/**
+ * The type TrajectoryEncoder remembers, between calls to encodeTrajectoryPoint, which boundary records contain
+ * all points in an area around the last point. Its fields are private to the library.
+ */
+#define MAX_TRAJECTORY_RECORDS              64          // Max. number of records remembered by a TrajectoryEncoder.
+
+typedef struct {
+    int extraDigits;                                                  // Number of extra "digits" to encode with.
+    int count;                                                        // Number of records (-1 if none remembered).
+    int minx, miny, maxx, maxy;                                       // Area (in microdegrees) in which the records apply.
+    short record[MAX_TRAJECTORY_RECORDS];                             // Records, in order of encoding.
+    short territory[MAX_TRAJECTORY_RECORDS];                          // Territory each record is encoded in.
+    short override[MAX_TRAJECTORY_RECORDS];                           // Territory each result is for (-1 if the same).
+} TrajectoryEncoder;
+
+/**
+ * The type CompiledMapcode holds a Mapcode parsed by compileMapcode: the territory it is decoded in, the boundary record
+ * that decodes it and its clean characters. It can be stored and decoded any number of times by decodeCompiledMapcode.
+ * Its fields are private to the library.
+ */
+typedef struct {
+    short territory;                                                  // Territory the Mapcode is decoded in.
+    short record;                                                     // Record that decodes it.
+    char kind;                                                        // How the record decodes it.
+    char mapcode[MAX_PROPER_MAPCODE_LEN + 1];                         // Proper Mapcode (uppercase, unpacked).
+    char extension[MAX_PRECISION_DIGITS + 1];                         // Extension characters (without the hyphen).
+} CompiledMapcode;
+
+/**
+ * The type TerritoryResults holds the results of decoding a Mapcode in every territory, by
+ * decodeMapcodeInAllTerritories: the territories it is valid in, with the coordinate it decodes to in each.
+ */
+#define MAX_NR_OF_TERRITORY_RESULTS         533         // Max. number of results (at most one per territory).
+
+typedef struct {
+    int count;                                                        // The number of results (length of arrays).
+    int territoryCode[MAX_NR_OF_TERRITORY_RESULTS];                   // Territory code of each result.
+    double lat[MAX_NR_OF_TERRITORY_RESULTS];                          // Latitude of each result, in degrees.
+    double lon[MAX_NR_OF_TERRITORY_RESULTS];                          // Longitude of each result, in degrees.
+} TerritoryResults;
+
 
 /**
  * Encode a latitude, longitude pair (in degrees) to a set of Mapcodes.
@@ -69,6 +124,170 @@ int encodeLatLonToMapcodes(
         int territoryCode,
         int extraDigits);
 
+/**
+ * Encode a latitude, longitude pair (in degrees) to a set of Mapcodes, like encodeLatLonToMapcodes without
+ * high-precision support: the coordinate is rounded to the nearest microdegree and at most 2 extra "digits" are
+ * generated. Both kinds of encoding are always available; encodeLatLonToMapcodes uses microdegree encoding if
+ * SUPPORT_HIGH_PRECISION is not defined (and, since the results are identical, for 0 extra "digits" and a whole
+ * number of microdegrees).
+ *
+ * Arguments:
+ *      mapcodes        - a pointer to an Mapcodes, allocated by the caller.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as encoding context.
+ *                        Pass 0 to get Mapcodes for all territories.
+ *      extraDigits     - Number of extra "digits" to add to the generated mapcode: 0, 1 or 2.
+ *
+ * Returns:
+ *      Number of results stored in parameter mapcodes. Always >= 0 (0 if no encoding was possible or an error occurred).
+ */
+int encodeLatLonToMicrodegreeMapcodes(
+        Mapcodes *mapcodes,
+        double lat,
+        double lon,
+        int territoryCode,
+        int extraDigits);
+
+/**
+ * Encode a latitude, longitude pair (in degrees) to a set of Mapcodes, for the given territories only. This takes a
+ * single search, skipping all other territories.
+ *
+ * Arguments:
+ *      mapcodes        - a pointer to an Mapcodes, allocated by the caller.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *      territories     - Territories to encode in (include the international territory code, "AAA", to also
+ *                        get the international Mapcode).
+ *      extraDigits     - Number of extra "digits" to add to the generated mapcode. The preferred default is 0.
+ *                        Other valid values are 1 and 2, which will add extra letters to the mapcodes to
+ *                        make them represent the coordinate more accurately.
+ *
+ * Returns:
+ *      Number of results stored in parameter mapcodes. Always >= 0 (0 if no encoding was possible or an error occurred).
+ *      The results are in the same order as those of encodeLatLonToMapcodes (with territoryCode 0).
+ */
+int encodeLatLonToMapcodesInTerritories(
+        Mapcodes *mapcodes,
+        double lat,
+        double lon,
+        const TerritorySet *territories,
+        int extraDigits);
+
+/**
+ * Initialise a TrajectoryEncoder, to encode a sequence of (usually nearby) points with encodeTrajectoryPoint.
+ *
+ * Arguments:
+ *      trajectory      - a pointer to a TrajectoryEncoder, allocated by the caller.
+ *      extraDigits     - Number of extra "digits" to add to the generated mapcodes, see encodeLatLonToMapcodes.
+ */
+void initTrajectoryEncoder(
+        TrajectoryEncoder *trajectory,
+        int extraDigits);
+
+/**
+ * Encode the next point of a trajectory to a set of Mapcodes for all territories, with the same results as
+ * encodeLatLonToMapcodes. While points stay in the same area (containing the same boundary records), only
+ * the remembered records are used; otherwise a full search is done, and its records are remembered.
+ *
+ * Arguments:
+ *      trajectory      - a pointer to a TrajectoryEncoder, initialised with initTrajectoryEncoder.
+ *      mapcodes        - a pointer to an Mapcodes, allocated by the caller.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *
+ * Returns:
+ *      Number of results stored in parameter mapcodes. Always >= 0 (0 if no encoding was possible or an error occurred).
+ */
+int encodeTrajectoryPoint(
+        TrajectoryEncoder *trajectory,
+        Mapcodes *mapcodes,
+        double lat,
+        double lon);
+
+/**
+ * Add a territory to a set of territories.
+ *
+ * Arguments:
+ *      territories     - Set of territories to add to.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode). Invalid codes are ignored.
+ */
+void addToTerritorySet(
+        TerritorySet *territories,
+        int territoryCode);
+
+/**
+ * Encode a latitude, longitude pair (in degrees) to a set of Mapcodes with the maximum number of extra "digits".
+ * This takes a single search for all precisions: every Mapcode with fewer extra "digits" is a prefix of the
+ * corresponding result (use getMapcodeWithPrecision to obtain it).
+ *
+ * Arguments:
+ *      mapcodes        - a pointer to an Mapcodes, allocated by the caller.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as encoding context.
+ *                        Pass 0 to get Mapcodes for all territories.
+ *
+ * Returns:
+ *      Number of results stored in parameter mapcodes, as encodeLatLonToMapcodes with extraDigits
+ *      MAX_PRECISION_DIGITS (always with high-precision support).
+ */
+int encodeLatLonToPreciseMapcodes(
+        Mapcodes *mapcodes,
+        double lat,
+        double lon,
+        int territoryCode);
+
+/**
+ * Get a Mapcode from encodeLatLonToPreciseMapcodes (or any other encode method) with fewer extra "digits".
+ *
+ * Arguments:
+ *      result          - Returned Mapcode. The caller should allocate at least MAX_MAPCODE_RESULT_LEN characters
+ *                        for the string.
+ *      mapcode         - Mapcode (possibly preceded by a territory) with extra "digits".
+ *      extraDigits     - Number of extra "digits" to keep, 0 for none.
+ *
+ * Returns:
+ *      result, which holds the Mapcode with at most extraDigits extra "digits".
+ */
+char *getMapcodeWithPrecision(
+        char *result,
+        const char *mapcode,
+        int extraDigits);
+
+/**
+ * Set the capacity of the cache of encode results. Results of encodeLatLonToMapcodes (and its deprecated variant)
+ * are cached per coordinate, territory and number of extra digits, least recently used results are replaced first.
+ * The cache is disabled until a capacity is set. Each entry takes about 600 bytes. If SUPPORT_ENCODE_CACHE is not
+ * defined, there is no cache and this method does nothing.
+ *
+ * This method is NOT thread-safe: it must not be called while other threads are encoding. Encoding with the
+ * cache is thread-safe: the cache is split into shards that are locked separately (also for a hit, which updates
+ * the order of use), so threads only wait for each other when encoding in the same shard. A disabled cache is not
+ * locked at all.
+ *
+ * Arguments:
+ *      capacity        - Number of results to cache. Pass 0 to disable the cache (and free its memory).
+ *
+ * Returns:
+ *      0 if (some of) the memory could not be allocated, or if there is no cache (unless capacity is 0), nonzero
+ *      otherwise.
+ */
+int setEncodeCacheCapacity(
+        int capacity);
+
+/**
+ * Get the number of cache hits and misses since the cache was first enabled (both 0 if SUPPORT_ENCODE_CACHE is
+ * not defined).
+ *
+ * Arguments:
+ *      hits            - Returned number of encodes that were found in the cache.
+ *      misses          - Returned number of encodes that were not found in the cache.
+ */
+void getEncodeCacheStatistics(
+        long *hits,
+        long *misses);
+
 /**
  * WARNING: This method is deprecated and should no longer be used, as it is not thread-safe. Use the version
  * specified above.
@@ -127,6 +346,54 @@ int encodeLatLonToSingleMapcode(
         int territoryCode,
         int extraDigits);
 
+/**
+ * Encode a latitude, longitude pair (in degrees) to at most two Mapcodes: the shortest possible for the given
+ * territory (which can be 0 for all territories), followed by the international Mapcode. This is much faster than
+ * encodeLatLonToMapcodes, as no other territories and records are tried.
+ *
+ * Arguments:
+ *      mapcodes        - a pointer to an Mapcodes, allocated by the caller.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as encoding context.
+ *                        Pass 0 to get the shortest Mapcode for all territories.
+ *      extraDigits     - Number of extra "digits" to add to the generated mapcode. The preferred default is 0.
+ *                        Other valid values are 1 and 2, which will add extra letters to the mapcodes to
+ *                        make them represent the coordinate more accurately.
+ *
+ * Returns:
+ *      Number of results stored in parameter mapcodes: 1 if the shortest Mapcode is the international Mapcode
+ *      (or if the point is not in the given territory), 2 otherwise.
+ */
+int encodeLatLonToShortestMapcodes(
+        Mapcodes *mapcodes,
+        double lat,
+        double lon,
+        int territoryCode,
+        int extraDigits);
+
+/**
+ * Encode a latitude, longitude pair (in degrees) to the international Mapcode (the Mapcode without a territory).
+ * This is much faster than encodeLatLonToMapcodes, as the international Mapcode is computed directly.
+ *
+ * Arguments:
+ *      result          - Returned Mapcode. The caller should allocate at least MAX_MAPCODE_RESULT_LEN characters
+ *                        for the string.
+ *      lat             - Latitude, in degrees. Range: -90..90.
+ *      lon             - Longitude, in degrees. Range: -180..180.
+ *      extraDigits     - Number of extra "digits" to add to the generated mapcode. The preferred default is 0.
+ *                        Other valid values are 1 and 2, which will add extra letters to the mapcodes to
+ *                        make them represent the coordinate more accurately.
+ *
+ * Returns:
+ *      0 if encoding failed, or >0 if it succeeded.
+ */
+int encodeLatLonToInternationalMapcode(
+        char *result,
+        double lat,
+        double lon,
+        int extraDigits);
+
 /**
  * Decode a Mapcode to  a latitude, longitude pair (in degrees).
  *
@@ -146,6 +413,108 @@ int decodeMapcodeToLatLon(
         const char *mapcode,
         int territoryCode);
 
+/**
+ * Decode a Mapcode to a latitude, longitude pair (in degrees), like decodeMapcodeToLatLon, directly from a buffer
+ * (for example a network buffer). The Mapcode does not need to be zero-terminated and is not copied.
+ *
+ * Arguments:
+ *      lat             - Decoded latitude, in degrees. Range: -90..90.
+ *      lon             - Decoded longitude, in degrees. Range: -180..180.
+ *      mapcode         - Mapcode to decode (the first length characters, or up to a zero-terminator).
+ *      length          - Number of characters of the Mapcode.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as decoding context.
+ *                        Pass 0 if not available.
+ *
+ * Returns:
+ *      0 if encoding succeeded, nonzero in case of error
+ */
+int decodeMapcodeToLatLonWithLength(
+        double *lat,
+        double *lon,
+        const char *mapcode,
+        size_t length,
+        int territoryCode);
+
+/**
+ * Decode a local Mapcode (without a territory, like "49.4V") in every territory in which it is valid. This gives
+ * the same coordinates as decodeMapcodeToLatLon with every territory code as context, but once per territory the
+ * Mapcode is actually decoded in: a context that decodeMapcodeToLatLon redirects (like a subdivision to its parent
+ * country for longer Mapcodes, or MEX to MX-MX for shorter ones) gives the result of the territory it redirects to.
+ * Only the territories with a boundary record for the shape and first character of the Mapcode are tried.
+ *
+ * Arguments:
+ *      results         - Results, allocated by the caller. They are in order of territory code, which is the
+ *                        territory each result is decoded in.
+ *      mapcode         - Mapcode to decode. If it includes a territory, or is an international Mapcode, it is only
+ *                        decoded in that territory.
+ *
+ * Returns:
+ *      Number of results stored in parameter results (0 if the Mapcode is not valid in any territory), or negative
+ *      if the Mapcode cannot be decoded at all.
+ */
+int decodeMapcodeInAllTerritories(
+        TerritoryResults *results,
+        const char *mapcode);
+
+/**
+ * Decode a Mapcode to a latitude, longitude pair in nanodegrees (billionths of degrees), like decodeMapcodeToLatLon.
+ * The result is computed in integer arithmetic from the first MAX_PRECISION_DIGITS extension characters, and truncated
+ * to whole nanodegrees, so it is the same on every platform.
+ *
+ * Arguments:
+ *      lat             - Decoded latitude, in nanodegrees. Range: -90000000000..90000000000.
+ *      lon             - Decoded longitude, in nanodegrees. Range: -180000000000..179999999999.
+ *      mapcode         - Mapcode to decode.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as decoding context.
+ *                        Pass 0 if not available.
+ *
+ * Returns:
+ *      0 if decoding succeeded, nonzero in case of error
+ */
+int decodeMapcodeToNanodegrees(
+        long long *lat,
+        long long *lon,
+        const char *mapcode,
+        int territoryCode);
+
+/**
+ * Parse a Mapcode once, for decoding it repeatedly with decodeCompiledMapcode. All work that only depends on the
+ * string (finding the territory, validating and cleaning the characters, and selecting the boundary record that
+ * decodes it) is done here. Mapcodes with more than MAX_PRECISION_DIGITS extension characters are rejected, although
+ * decodeMapcodeToLatLon accepts them.
+ *
+ * Arguments:
+ *      compiled        - Compiled Mapcode, allocated by the caller.
+ *      mapcode         - Mapcode to parse, as passed to decodeMapcodeToLatLon.
+ *      territoryCode   - Territory code (obtained from convertTerritoryIsoNameToCode), used as decoding context.
+ *                        Pass 0 if not available.
+ *
+ * Returns:
+ *      0 if parsing succeeded, nonzero in case of error (-10 if the extension has more than MAX_PRECISION_DIGITS
+ *      characters).
+ */
+int compileMapcode(
+        CompiledMapcode *compiled,
+        const char *mapcode,
+        int territoryCode);
+
+/**
+ * Decode a Mapcode parsed by compileMapcode to a latitude, longitude pair (in degrees). The result is the same as
+ * decoding the original Mapcode with decodeMapcodeToLatLon.
+ *
+ * Arguments:
+ *      lat             - Decoded latitude, in degrees. Range: -90..90.
+ *      lon             - Decoded longitude, in degrees. Range: -180..180.
+ *      compiled        - Compiled Mapcode, filled by a successful call to compileMapcode.
+ *
+ * Returns:
+ *      0 if decoding succeeded, nonzero in case of error
+ */
+int decodeCompiledMapcode(
+        double *lat,
+        double *lon,
+        const CompiledMapcode *compiled);
+
 /**
  * Checks if a string has the format of a Mapcode. (Note: The method is called compareXXX rather than hasXXX because
  * the return value '0' indicates the string has the Mapcode format, much like string comparison strcmp returns.)
@@ -322,4 +691,16 @@ const UWORD *encodeToAlphabet(const char *string, int alphabet);
 
 #ifdef __cplusplus
 }
+
+#if __cplusplus >= 201703L
+#include <string_view>
+
+/**
+ * Decode a Mapcode to a latitude, longitude pair (in degrees), see decodeMapcodeToLatLonWithLength.
+ */
+inline int decodeMapcodeToLatLon(double *lat, double *lon, std::string_view mapcode, int territoryCode)
+{
+    return decodeMapcodeToLatLonWithLength(lat, lon, mapcode.data(), mapcode.size(), territoryCode);
+}
+#endif
 #endif
@@ -60,6 +60,7 @@ static const int INTERNAL_ERROR = 2;
 static const double PI = 3.14159265358979323846;
 static const int SHOW_PROGRESS = 125;
 static const double DELTA = 0.001;
+static const int ENCODE_CACHE_CAPACITY = 64;
 
 
 /**
@@ -129,6 +130,12 @@ static void usage(const char *appName) {
     printf("       %s -g    100 : produces a grid of 100 points as lat/lon pairs\n", appName);
     printf("       %s -gXYZ 100 : produces a grid of 100 points as (x, y, z) sphere coordinates)\n", appName);
     printf("\n");
+    printf("    %s [-p | --performance] <nrOfPoints> [<seed>]\n", appName);
+    printf("\n");
+    printf("       Measure the performance of internal lookups of the library for a random\n");
+    printf("       uniformly distributed set of lat/lons, and check that optimized lookups\n");
+    printf("       produce the same results as the original implementation.\n");
+    printf("\n");
     printf("       Notes on the use of stdout and stderr:\n");
     printf("       stdout: used for outputting 3D point data; stderr: used for statistics.\n");
     printf("       You can redirect stdout to a destination file, while stderr will show progress.\n");
@@ -276,6 +283,391 @@ static void selfCheckMapcodeToLatLon(const char *territory, const char *mapcode,
     }
 }
 
+
+/**
+ * This method provides a self-check for encoding lat/lon to the shortest Mapcodes: these must be the
+ * first Mapcode for all territories and the international Mapcode (if that is not the first).
+ */
+static void selfCheckShortestMapcodes(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    Mapcodes mapcodes;
+    const int nrResults = encodeLatLonToShortestMapcodes(&mapcodes, lat, lon, 0, extraDigits);
+    const int nrExpected = (expected->count == 1) ? 1 : 2;
+    if ((nrResults != nrExpected) ||
+        (strcmp(mapcodes.mapcode[0], expected->mapcode[0]) != 0) ||
+        (strcmp(mapcodes.mapcode[nrResults - 1], expected->mapcode[expected->count - 1]) != 0)) {
+        fprintf(stderr, "error: encoding lat/lon to shortest mapcodes failure; "
+                        "lat=%.12g, lon=%.12g produces %d mapcodes instead of %d, or not '%s' and '%s'\n",
+                lat, lon, nrResults, nrExpected, expected->mapcode[0], expected->mapcode[expected->count - 1]);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for encoding lat/lon to the international Mapcode: it must be the
+ * last Mapcode for all territories.
+ */
+static void selfCheckInternationalMapcode(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    char mapcode[MAX_MAPCODE_RESULT_LEN];
+    const char *expectedMapcode = expected->mapcode[expected->count - 1];
+    if (!encodeLatLonToInternationalMapcode(mapcode, lat, lon, extraDigits) ||
+        (strcmp(mapcode, expectedMapcode) != 0)) {
+        fprintf(stderr, "error: encoding lat/lon to international mapcode failure; "
+                        "lat=%.12g, lon=%.12g does not produce '%s'\n",
+                lat, lon, expectedMapcode);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+#ifdef SUPPORT_HIGH_PRECISION
+
+/**
+ * This method provides a self-check for encoding lat/lon to Mapcodes with all precisions at once: each
+ * Mapcode, reduced to extraDigits, must be the corresponding Mapcode for all territories.
+ */
+static void selfCheckPreciseMapcodes(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    Mapcodes mapcodes;
+    const int nrResults = encodeLatLonToPreciseMapcodes(&mapcodes, lat, lon, 0);
+    if (nrResults != expected->count) {
+        fprintf(stderr, "error: encoding lat/lon to precise mapcodes failure; "
+                        "lat=%.12g, lon=%.12g produces %d mapcodes instead of %d\n",
+                lat, lon, nrResults, expected->count);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+    for (int i = 0; i < nrResults; ++i) {
+        char mapcode[MAX_MAPCODE_RESULT_LEN];
+        if (strcmp(getMapcodeWithPrecision(mapcode, mapcodes.mapcode[i], extraDigits), expected->mapcode[i]) != 0) {
+            fprintf(stderr, "error: encoding lat/lon to precise mapcodes failure; "
+                            "lat=%.12g, lon=%.12g produces '%s', which does not reduce to '%s'\n",
+                    lat, lon, mapcodes.mapcode[i], expected->mapcode[i]);
+            if (selfCheckEnabled) {
+                exit(INTERNAL_ERROR);
+            }
+            return;
+        }
+    }
+}
+
+#endif // SUPPORT_HIGH_PRECISION
+
+
+/**
+ * This method provides a self-check for encoding lat/lon to Mapcodes in a set of territories: for the
+ * territories of every other Mapcode for all territories, it must produce the Mapcodes in those territories.
+ */
+static void selfCheckMapcodesInTerritories(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    int territoryCodes[MAX_NR_OF_MAPCODE_RESULTS];
+    for (int i = 0; i < expected->count; ++i) {
+        char territory[MAX_MAPCODE_RESULT_LEN];
+        strcpy(territory, expected->mapcode[i]);
+        char *space = strchr(territory, ' ');
+        if (space) {
+            *space = 0;
+        }
+        territoryCodes[i] = convertTerritoryIsoNameToCode(space ? territory : "AAA", 0);
+    }
+    TerritorySet territories;
+    memset(&territories, 0, sizeof(territories));
+    for (int i = 0; i < expected->count; i += 2) {
+        addToTerritorySet(&territories, territoryCodes[i]);
+    }
+
+    Mapcodes mapcodes;
+    const int nrResults = encodeLatLonToMapcodesInTerritories(&mapcodes, lat, lon, &territories, extraDigits);
+    int nrExpected = 0;
+    for (int i = 0; i < expected->count; ++i) {
+        int included = 0;
+        for (int j = 0; j < expected->count; j += 2) {
+            included = included || (territoryCodes[j] == territoryCodes[i]);
+        }
+        if (!included) {
+            continue;
+        }
+        if ((nrExpected >= nrResults) || (strcmp(mapcodes.mapcode[nrExpected], expected->mapcode[i]) != 0)) {
+            fprintf(stderr, "error: encoding lat/lon to mapcodes in territories failure; "
+                            "lat=%.12g, lon=%.12g does not produce '%s' as result %d\n",
+                    lat, lon, expected->mapcode[i], nrExpected);
+            if (selfCheckEnabled) {
+                exit(INTERNAL_ERROR);
+            }
+            return;
+        }
+        ++nrExpected;
+    }
+    if (nrResults != nrExpected) {
+        fprintf(stderr, "error: encoding lat/lon to mapcodes in territories failure; "
+                        "lat=%.12g, lon=%.12g produces %d mapcodes instead of %d\n",
+                lat, lon, nrResults, nrExpected);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method returns nonzero if two sets of Mapcodes are the same (in the same order).
+ */
+static int sameMapcodes(const Mapcodes *mapcodes1, const Mapcodes *mapcodes2) {
+    if (mapcodes1->count != mapcodes2->count) {
+        return 0;
+    }
+    for (int i = 0; i < mapcodes1->count; ++i) {
+        if (strcmp(mapcodes1->mapcode[i], mapcodes2->mapcode[i]) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/**
+ * This method provides a self-check for encoding the generated points as a trajectory: each point must
+ * produce the Mapcodes for all territories.
+ */
+static void selfCheckTrajectoryPoint(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    static TrajectoryEncoder trajectory;
+    static int trajectoryExtraDigits = -1;
+    if (extraDigits != trajectoryExtraDigits) {
+        initTrajectoryEncoder(&trajectory, extraDigits);
+        trajectoryExtraDigits = extraDigits;
+    }
+    Mapcodes mapcodes;
+    encodeTrajectoryPoint(&trajectory, &mapcodes, lat, lon);
+    if (!sameMapcodes(&mapcodes, expected)) {
+        fprintf(stderr, "error: encoding trajectory point failure; "
+                        "lat=%.12g, lon=%.12g produces %d mapcodes, not the %d mapcodes for all territories\n",
+                lat, lon, mapcodes.count, expected->count);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for the cache of encode results (if the library has one): encoding
+ * lat/lon twice must produce a miss and a hit, both with the Mapcodes for all territories.
+ */
+static void selfCheckEncodeCache(double lat, double lon, int extraDigits, const Mapcodes *expected) {
+    if (!setEncodeCacheCapacity(ENCODE_CACHE_CAPACITY)) {
+        return; // No cache.
+    }
+    long hits;
+    long misses;
+    getEncodeCacheStatistics(&hits, &misses);
+    Mapcodes mapcodes1;
+    Mapcodes mapcodes2;
+    encodeLatLonToMapcodes(&mapcodes1, lat, lon, 0, extraDigits);
+    encodeLatLonToMapcodes(&mapcodes2, lat, lon, 0, extraDigits);
+    long foundHits;
+    long foundMisses;
+    getEncodeCacheStatistics(&foundHits, &foundMisses);
+    setEncodeCacheCapacity(0);
+
+    if ((foundHits != hits + 1) || (foundMisses != misses + 1) ||
+        !sameMapcodes(&mapcodes1, expected) || !sameMapcodes(&mapcodes2, expected)) {
+        fprintf(stderr, "error: encode cache failure; "
+                        "encoding lat=%.12g, lon=%.12g twice gives %ld hits and %ld misses, "
+                        "or not the mapcodes for all territories\n",
+                lat, lon, foundHits - hits, foundMisses - misses);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for encoding lat/lon to Mapcodes in microdegrees: for a whole number
+ * of microdegrees and no extra digits, it must produce the Mapcodes for all territories, and its Mapcodes
+ * must decode close to lat/lon.
+ */
+static void selfCheckMicrodegreeMapcodes(double lat, double lon, int extraDigits) {
+    const double microLat = floor((lat * 1000000.0) + 0.5) / 1000000.0;
+    const double microLon = floor((lon * 1000000.0) + 0.5) / 1000000.0;
+    Mapcodes expected;
+    Mapcodes mapcodes;
+    encodeLatLonToMapcodes(&expected, microLat, microLon, 0, 0);
+    encodeLatLonToMicrodegreeMapcodes(&mapcodes, microLat, microLon, 0, 0);
+    if (!sameMapcodes(&mapcodes, &expected)) {
+        fprintf(stderr, "error: encoding lat/lon to microdegree mapcodes failure; "
+                        "lat=%.12g, lon=%.12g produces %d mapcodes, not the %d mapcodes for all territories\n",
+                microLat, microLon, mapcodes.count, expected.count);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+
+    encodeLatLonToMicrodegreeMapcodes(&mapcodes, lat, lon, 0, (extraDigits < 2) ? extraDigits : 2);
+    for (int i = 0; i < mapcodes.count; ++i) {
+        double foundLat;
+        double foundLon;
+        const int err = decodeMapcodeToLatLon(&foundLat, &foundLon, mapcodes.mapcode[i], 0);
+        double deltaLon = fabs(foundLon - lon);
+        if (deltaLon > 180.0) {
+            deltaLon = 360.0 - deltaLon;
+        }
+        if ((err != 0) || (fabs(foundLat - lat) > DELTA) || (deltaLon > DELTA)) {
+            fprintf(stderr, "error: encoding lat/lon to microdegree mapcodes failure; "
+                            "lat=%.12g, lon=%.12g produces '%s', which does not decode to it\n",
+                    lat, lon, mapcodes.mapcode[i]);
+            if (selfCheckEnabled) {
+                exit(INTERNAL_ERROR);
+            }
+            return;
+        }
+    }
+}
+
+
+/**
+ * This method provides a self-check for decoding a Mapcode of a given length: followed by other characters,
+ * it must decode to the same lat/lon as the Mapcode itself.
+ */
+static void selfCheckMapcodeWithLengthToLatLon(const char *territory, const char *mapcode) {
+    int context = convertTerritoryIsoNameToCode(territory, 0);
+    double lat = 0.0;
+    double lon = 0.0;
+    int err = decodeMapcodeToLatLon(&lat, &lon, mapcode, context);
+    char input[MAX_MAPCODE_RESULT_LEN + 16];
+    sprintf(input, "%s 49.4V-K2 NLD", mapcode);
+    double foundLat = 0.0;
+    double foundLon = 0.0;
+    int foundErr = decodeMapcodeToLatLonWithLength(&foundLat, &foundLon, input, strlen(mapcode), context);
+    if ((foundErr != err) || ((err == 0) && ((foundLat != lat) || (foundLon != lon)))) {
+        fprintf(stderr, "error: decoding mapcode with length to lat/lon failure; "
+                        "'%s %s' decodes to lat=%.12g, lon=%.12g (error %d) instead of "
+                        "lat=%.12g, lon=%.12g (error %d)\n",
+                territory, mapcode, foundLat, foundLon, foundErr, lat, lon, err);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for decoding a compiled Mapcode: it must decode to the same lat/lon as
+ * the Mapcode itself.
+ */
+static void selfCheckCompiledMapcodeToLatLon(const char *territory, const char *mapcode) {
+    int context = convertTerritoryIsoNameToCode(territory, 0);
+    double lat = 0.0;
+    double lon = 0.0;
+    int err = decodeMapcodeToLatLon(&lat, &lon, mapcode, context);
+    CompiledMapcode compiled;
+    double foundLat = 0.0;
+    double foundLon = 0.0;
+    int foundErr = compileMapcode(&compiled, mapcode, context);
+    if (foundErr == 0) {
+        foundErr = decodeCompiledMapcode(&foundLat, &foundLon, &compiled);
+    }
+    if (((foundErr != 0) != (err != 0)) || ((err == 0) && ((foundLat != lat) || (foundLon != lon)))) {
+        fprintf(stderr, "error: decoding compiled mapcode to lat/lon failure; "
+                        "'%s %s' decodes to lat=%.12g, lon=%.12g (error %d) instead of "
+                        "lat=%.12g, lon=%.12g (error %d)\n",
+                territory, mapcode, foundLat, foundLon, foundErr, lat, lon, err);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for decoding a Mapcode to nanodegrees: it must be within a nanodegree
+ * of the lat/lon that the Mapcode decodes to.
+ */
+static void selfCheckMapcodeToNanodegrees(const char *territory, const char *mapcode) {
+    int context = convertTerritoryIsoNameToCode(territory, 0);
+    double lat = 0.0;
+    double lon = 0.0;
+    int err = decodeMapcodeToLatLon(&lat, &lon, mapcode, context);
+    long long foundLat = 0;
+    long long foundLon = 0;
+    int foundErr = decodeMapcodeToNanodegrees(&foundLat, &foundLon, mapcode, context);
+    if ((foundErr != err) ||
+        ((err == 0) && ((fabs((lat * 1.0e9) - foundLat) > 1.0) || (fabs((lon * 1.0e9) - foundLon) > 1.0)))) {
+        fprintf(stderr, "error: decoding mapcode to nanodegrees failure; "
+                        "'%s %s' decodes to lat=%lld, lon=%lld (error %d) instead of "
+                        "lat=%.12g, lon=%.12g (error %d)\n",
+                territory, mapcode, foundLat, foundLon, foundErr, lat, lon, err);
+        if (selfCheckEnabled) {
+            exit(INTERNAL_ERROR);
+        }
+        return;
+    }
+}
+
+
+/**
+ * This method provides a self-check for decoding a Mapcode in all territories: it must produce the
+ * coordinates that the Mapcode decodes to in each territory, and nothing else.
+ */
+static void selfCheckMapcodeInAllTerritories(const char *mapcode) {
+    TerritoryResults results;
+    int nrResults = decodeMapcodeInAllTerritories(&results, mapcode);
+    if (nrResults < 0) {
+        nrResults = 0;
+    }
+    int matched[MAX_NR_OF_TERRITORY_RESULTS] = {0};
+    for (int context = 1; context <= MAX_MAPCODE_TERRITORY_CODE; ++context) {
+        double lat;
+        double lon;
+        if (decodeMapcodeToLatLon(&lat, &lon, mapcode, context) != 0) {
+            continue;
+        }
+        int found = 0;
+        for (int i = 0; i < nrResults; ++i) {
+            if ((results.lat[i] == lat) && (results.lon[i] == lon)) {
+                matched[i] = 1;
+                found = 1;
+            }
+        }
+        if (!found) {
+            char territory[MAX_ISOCODE_LEN + 1];
+            fprintf(stderr, "error: decoding mapcode in all territories failure; "
+                            "mapcode '%s %s' decodes to lat=%.12g, lon=%.12g, which is not among the %d results\n",
+                    getTerritoryIsoName(territory, context, 0), mapcode, lat, lon, nrResults);
+            if (selfCheckEnabled) {
+                exit(INTERNAL_ERROR);
+            }
+            return;
+        }
+    }
+    for (int i = 0; i < nrResults; ++i) {
+        if (!matched[i]) {
+            char territory[MAX_ISOCODE_LEN + 1];
+            fprintf(stderr, "error: decoding mapcode in all territories failure; "
+                            "result lat=%.12g, lon=%.12g for '%s %s' is not decoded in any territory\n",
+                    results.lat[i], results.lon[i], getTerritoryIsoName(territory, results.territoryCode[i], 0),
+                    mapcode);
+            if (selfCheckEnabled) {
+                exit(INTERNAL_ERROR);
+            }
+            return;
+        }
+    }
+}
+
+
 static void generateAndOutputMapcodes(double lat, double lon, int iShowError, int extraDigits, int useXYZ) {
 
     char *results[2 * MAX_NR_OF_MAPCODE_RESULTS];
@@ -333,9 +725,34 @@ static void generateAndOutputMapcodes(double lat, double lon, int iShowError, in
         if (selfCheckEnabled) {
             selfCheckLatLonToMapcode(lat, lon, foundTerritory, foundMapcode, extraDigits);
             selfCheckMapcodeToLatLon(foundTerritory, foundMapcode, lat, lon);
+            selfCheckMapcodeWithLengthToLatLon(foundTerritory, foundMapcode);
+            selfCheckCompiledMapcodeToLatLon(foundTerritory, foundMapcode);
+            selfCheckMapcodeToNanodegrees(foundTerritory, foundMapcode);
+
+            // Decoding in all territories is checked for one (varying) Mapcode per point, as it decodes the Mapcode
+            // in every territory.
+            if (j == (totalNrOfResults % nrResults)) {
+                selfCheckMapcodeInAllTerritories(foundMapcode);
+            }
         }
     }
 
+    // Self-checking code to see if the other encoders agree with the encoder.
+    if (selfCheckEnabled && (nrResults > 0)) {
+        Mapcodes mapcodes;
+        encodeLatLonToMapcodes(&mapcodes, lat, lon, context, extraDigits);
+        selfCheckShortestMapcodes(lat, lon, extraDigits, &mapcodes);
+        selfCheckInternationalMapcode(lat, lon, extraDigits, &mapcodes);
+        // Precise Mapcodes only reduce to the Mapcodes of the encoder if that uses high precision.
+#ifdef SUPPORT_HIGH_PRECISION
+        selfCheckPreciseMapcodes(lat, lon, extraDigits, &mapcodes);
+#endif
+        selfCheckMapcodesInTerritories(lat, lon, extraDigits, &mapcodes);
+        selfCheckTrajectoryPoint(lat, lon, extraDigits, &mapcodes);
+        selfCheckEncodeCache(lat, lon, extraDigits, &mapcodes);
+        selfCheckMicrodegreeMapcodes(lat, lon, extraDigits);
+    }
+
     // Add empty line.
     printf("\n");
 
@@ -383,6 +800,51 @@ static void showProgress(int i) {
 }
 
 
+/**
+ * This method returns the time in milliseconds between two clock() values.
+ */
+static double elapsedMillis(clock_t start, clock_t end) {
+    return ((double) (end - start) * 1000.0) / CLOCKS_PER_SEC;
+}
+
+
+/**
+ * This method measures the time needed to find the candidate territories for a set of points
+ * (in microdegrees), using the original walk over the redivar kd-tree and the breadth-first
+ * tree used by the encoder. Returns the number of points for which the results differ.
+ */
+static int benchmarkTerritoryCandidates(const int *x, const int *y, int nrOfPoints) {
+#ifdef FAST_ENCODE
+    int differences = 0;
+    long checksum = 0;
+    initTables();
+    for (int i = 0; i < nrOfPoints; ++i) {
+        if (redivarWalk(x[i], y[i]) != redivarLeafOf(x[i], y[i])) {
+            ++differences;
+        }
+    }
+
+    clock_t start = clock();
+    for (int i = 0; i < nrOfPoints; ++i) {
+        checksum += *redivarWalk(x[i], y[i]);
+    }
+    clock_t middle = clock();
+    for (int i = 0; i < nrOfPoints; ++i) {
+        checksum += *redivarLeafOf(x[i], y[i]);
+    }
+    clock_t end = clock();
+
+    fprintf(stderr, "Territory candidates (redivar walk)          : %10.3f ms\n", elapsedMillis(start, middle));
+    fprintf(stderr, "Territory candidates (breadth-first tree)    : %10.3f ms\n", elapsedMillis(middle, end));
+    fprintf(stderr, "Territory candidates differences             : %d (checksum %ld)\n", differences, checksum);
+    return differences;
+#else
+    fprintf(stderr, "Territory candidates: not available (FAST_ENCODE disabled)\n");
+    return 0;
+#endif
+}
+
+
 /**
  * This is the main() method which is called from the command-line.
  * Return code 0 means success. Any other values means some sort of error occurred.
@@ -531,6 +993,9 @@ int main(const int argc, const char **argv) {
             // Self-checking code to see if decoder produces the lat/lon for all of these Mapcodes.
             if (selfCheckEnabled) {
                 selfCheckMapcodeToLatLon(foundTerritory, foundMapcode, lat, lon);
+                selfCheckMapcodeWithLengthToLatLon(foundTerritory, foundMapcode);
+                selfCheckCompiledMapcodeToLatLon(foundTerritory, foundMapcode);
+                selfCheckMapcodeToNanodegrees(foundTerritory, foundMapcode);
             }
         }
     }
@@ -678,6 +1143,48 @@ int main(const int argc, const char **argv) {
         }
         outputStatistics();
     }
+    else if ((strcmp(cmd, "-p") == 0) || (strcmp(cmd, "--performance") == 0)) {
+
+        // ------------------------------------------------------------------
+        // Measure performance: [-p | --performance] <nrOfPoints> [<seed>]
+        // ------------------------------------------------------------------
+        if ((argc < 3) || (argc > 4)) {
+            fprintf(stderr, "error: incorrect number of arguments\n\n");
+            usage(appName);
+            return NORMAL_ERROR;
+        }
+        int nrOfPoints = atoi(argv[2]);
+        if (nrOfPoints < 1) {
+            fprintf(stderr, "error: total number of points to generate must be >= 1\n\n");
+            usage(appName);
+            return NORMAL_ERROR;
+        }
+        srand((unsigned int) ((argc == 4) ? atoi(argv[3]) : time(0)));
+
+        int *x = (int *) malloc(nrOfPoints * sizeof(int));
+        int *y = (int *) malloc(nrOfPoints * sizeof(int));
+        if ((x == 0) || (y == 0)) {
+            fprintf(stderr, "error: cannot allocate %d points\n", nrOfPoints);
+            return INTERNAL_ERROR;
+        }
+        for (int i = 0; i < nrOfPoints; ++i) {
+            double lat;
+            double lon;
+            unitToLatLonDeg(((double) rand()) / RAND_MAX, ((double) rand()) / RAND_MAX, &lat, &lon);
+            if (lon >= 180.0) {
+                lon -= 360.0;
+            }
+            x[i] = (int) floor(lon * 1000000.0);
+            y[i] = (int) floor(lat * 1000000.0);
+        }
+
+        int differences = benchmarkTerritoryCandidates(x, y, nrOfPoints);
+        free(x);
+        free(y);
+        if (differences != 0) {
+            return INTERNAL_ERROR;
+        }
+    }
     else {
 
         // ------------------------------------------------------------------